@@ -1,109 +1,365 @@
 #include "buffer.h"
+#include "scan.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/*
+ * A gap buffer. The runes live in runes[0, gap_begin) and runes[gap_end, capacity).
+ * Every edit first moves the gap to the edit position, so as long as the edits
+ * follow the cursor only the runes between the old and new edit position move.
+ *
+ * The positions of the newlines are kept in a second gap array that moves along
+ * with the first one. Newlines before the gap are stored as their position and
+ * newlines after the gap as their distance from the end of the buffer, so
+ * neither half changes when runes are inserted or deleted at the gap.
+ */
 struct buffer {
-	isize  length;
-	char   runes[1 << 30];
+	char  *runes;
+	isize  gap_begin;
+	isize  gap_end;
+	isize  capacity;
+	struct {
+		isize *data;
+		isize  front;    // Newlines before the gap, in data[0, front)
+		isize  back;     // Newlines after the gap, in data[capacity - back, capacity)
+		isize  capacity;
+	} lines;
 };
 
-static buffer *buffers[1];
+#define GAP_MIN (64 * 1024)
+
+static void  move_gap(buffer*, isize);
+static void  grow_gap(buffer*, isize);
+static void  index_lines(buffer*, isize, s8);
+static isize newline(buffer*, isize);
 
 buffer*
 buffer_new(arena *arena) {
-	for(int i = 0; i < countof(buffers); ++i) {
-		if(!buffers[i]) {
-			buffer *buf = arena_alloc(arena, sizeof(buffer), 1 << 16, 1, ALLOC_NOZERO);
-			buf->length = 0;
-			return buffers[i] = buf;
+	buffer *buf = calloc(1, sizeof(buffer));
+
+	if(!buf || !(buf->runes = malloc(GAP_MIN))) {
+		free(buf);
+		return 0;
+	}
+
+	buf->gap_end = buf->capacity = GAP_MIN;
+	return buf;
+}
+
+buffer*
+buffer_open(arena *arena, const char *file_path, isize *read) {
+	FILE   *file = fopen(file_path, "rb");
+	buffer *buf  = file ? buffer_new(arena) : 0;
+
+	if(!buf) {
+		goto FAIL;
+	}
+
+	// The gap stays at the end, so read straight into it
+	while(!feof(file)) {
+		grow_gap(buf, GAP_MIN);
+		s8 runes = { .data = buf->runes + buf->gap_begin };
+		runes.length = (isize)fread(runes.data, 1, (size_t)(buf->gap_end - buf->gap_begin), file);
+
+		if(ferror(file)) {
+			goto FAIL;
+		}
+
+		index_lines(buf, buf->gap_begin, runes);
+		buf->gap_begin += runes.length;
+
+		if(read) {
+			__atomic_store_n(read, buf->gap_begin, __ATOMIC_RELAXED);
 		}
 	}
 
+	fclose(file);
+	return buf;
+
+FAIL:
+	if(file) fclose(file);
+	if(buf)  buffer_free(buf);
 	return 0;
 }
 
-void
-buffer_free(buffer *buf) {
-	for(int i = 0; i < countof(buffers); ++i) {
-		if(buffers[i] == buf) {
-			buffers[i] = 0;
-			return;
-		}
+b32
+buffer_save(buffer *buf, const char *file_path) {
+	FILE *file = fopen(file_path, "wb");
+
+	if(!file) {
+		return 0;
+	}
+
+	size_t head = (size_t)buf->gap_begin;
+	size_t tail = (size_t)(buf->capacity - buf->gap_end);
+	b32 ok = fwrite(buf->runes, 1, head, file) == head;
+	ok = ok && fwrite(buf->runes + buf->gap_end, 1, tail, file) == tail;
+	return !fclose(file) && ok;
+}
+
+/* A gap buffer shares nothing, so the snapshot is a copy without a gap. */
+buffer*
+buffer_snapshot(buffer *buf) {
+	buffer *snap   = calloc(1, sizeof(buffer));
+	isize   length = buffer_length(buf);
+
+	if(!snap || !(snap->runes = malloc((size_t)(length ? length : 1)))) {
+		free(snap);
+		return 0;
 	}
 
-	assert(0);
+	buffer_copy(buf, 0, length, snap->runes);
+	snap->gap_begin = snap->gap_end = snap->capacity = length;
+	return snap;
+}
+
+void
+buffer_free(buffer *buf) {
+	free(buf->lines.data);
+	free(buf->runes);
+	free(buf);
 }
 
 void
 buffer_insert_runes(buffer *buf, isize at, s8 runes) {
 	if(runes.length) {
-		assert(at <= buf->length);
-		memmove(buf->runes + at + runes.length, buf->runes + at, (size_t)(buf->length - at));
-		memcpy(buf->runes + at, runes.data, (size_t)runes.length);
-		buf->length += runes.length;
+		assert(at <= buffer_length(buf));
+		grow_gap(buf, runes.length);
+		move_gap(buf, at);
+		memcpy(buf->runes + buf->gap_begin, runes.data, (size_t)runes.length);
+		index_lines(buf, at, runes);
+		buf->gap_begin += runes.length;
 	}
 }
 
 void
 buffer_delete_runes(buffer *buf, isize begin, isize end) {
 	if(begin < end) {
-		assert(end <= buf->length);
-		memmove(buf->runes + begin, buf->runes + end, (size_t)(buf->length - end));
-		buf->length -= end - begin;
+		assert(end <= buffer_length(buf));
+		move_gap(buf, begin);
+		isize  length = buffer_length(buf);
+		isize *back   = buf->lines.data + buf->lines.capacity;
+
+		while(buf->lines.back && length - back[-buf->lines.back] < end) {
+			buf->lines.back--;
+		}
+
+		buf->gap_end += end - begin;
 	}
 }
 
 isize
 buffer_bol(buffer *buf, isize pos) {
-	isize i;
-
-	for(i = pos - 1; i >= 0; --i) {
-		if(buf->runes[i] == '\n') {
-			break;
-		}
-	}
-
-	return i+1;
+	return buffer_line_begin(buf, buffer_line_at(buf, pos));
 }
 
 isize
 buffer_eol(buffer *buf, isize pos) {
-	for(isize i = pos; i < buf->length; ++i) {
-		if(buf->runes[i] == '\n') {
-			return i;
-		}
-	}
-
-	return buf->length;
+	isize line = buffer_line_at(buf, pos);
+	return line + 1 < buffer_line_count(buf) ? newline(buf, line) : buffer_length(buf);
 }
 
 isize
 buffer_length(buffer *buf) {
-	return buf->length;
+	return buf->capacity - (buf->gap_end - buf->gap_begin);
 }
 
 int
 buffer_get(buffer *buf, isize pos) {
-	return pos < buf->length ? buf->runes[pos] & 0xFF : -1;
+	if(pos < buf->gap_begin) {
+		return buf->runes[pos] & 0xFF;
+	}
+
+	return pos < buffer_length(buf) ? buf->runes[pos + buf->gap_end - buf->gap_begin] & 0xFF : -1;
 }
 
 line_info
 buffer_line_info(buffer *buf, isize at) {
-	line_info li = {0};
+	isize line = buffer_line_at(buf, at);
+	return (line_info) {
+		.line = (int)line + 1,
+		.col  = (int)(at - buffer_line_begin(buf, line)) + 1,
+	};
+}
+
+isize
+buffer_line_count(buffer *buf) {
+	return buf->lines.front + buf->lines.back + 1;
+}
+
+isize
+buffer_line_begin(buffer *buf, isize line) {
+	return line ? newline(buf, line - 1) + 1 : 0;
+}
+
+/* Counts the newlines before pos by binary searching the halves of the index. */
+isize
+buffer_line_at(buffer *buf, isize pos) {
+	isize *front  = buf->lines.data;
+	isize *back   = buf->lines.data + buf->lines.capacity - buf->lines.back;
+	isize  length = buffer_length(buf);
+	isize  lo     = 0;
+	isize  hi     = buf->lines.front;
 
-	for(isize i = 0; i < at; ++i) {
-		li.line += buf->runes[i] == '\n';
-		li.col  *= buf->runes[i] != '\n';
-		li.col  += buf->runes[i] != '\n';
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+
+		if(front[mid] < pos) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if(lo < buf->lines.front) {
+		return lo;
 	}
 
-	li.col++;
-	li.line++;
-	return li;
+	lo = 0;
+	hi = buf->lines.back;
+
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+
+		if(length - back[mid] < pos) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return buf->lines.front + lo;
 }
 
+/* Returns the contiguous runes at byte_index, i.e. up to the gap or up to the end. */
 const char*
-buffer_read(buffer *buf, uint32_t byte_index, uint32_t *bytes_read) {
-	*bytes_read = (uint32_t)buf->length - byte_index;
-	return buf->runes + byte_index;
+buffer_read(buffer *buf, isize byte_index, isize *bytes_read) {
+	isize length = buffer_length(buf);
+
+	if(byte_index >= length) {
+		*bytes_read = 0;
+		return "";
+	} else if(byte_index < buf->gap_begin) {
+		*bytes_read = buf->gap_begin - byte_index;
+		return buf->runes + byte_index;
+	} else {
+		*bytes_read = length - byte_index;
+		return buf->runes + byte_index + buf->gap_end - buf->gap_begin;
+	}
+}
+
+buffer_iter
+buffer_iter_begin(buffer *buf, isize begin, isize end) {
+	assert(0 <= begin && begin <= end && end <= buffer_length(buf));
+	return (buffer_iter) { buf, begin, end, 0 };
+}
+
+/* Yields at most two chunks, the runes before and after the gap. */
+b32
+buffer_iter_next(buffer_iter *it, s8 *chunk) {
+	buffer *buf = it->buf;
+
+	if(it->pos >= it->end) {
+		return 0;
+	}
+
+	if(it->pos < buf->gap_begin) {
+		chunk->data   = buf->runes + it->pos;
+		chunk->length = (it->end < buf->gap_begin ? it->end : buf->gap_begin) - it->pos;
+	} else {
+		chunk->data   = buf->runes + it->pos + buf->gap_end - buf->gap_begin;
+		chunk->length = it->end - it->pos;
+	}
+
+	it->pos += chunk->length;
+	return 1;
+}
+
+/* Copies the runes in [begin, end) to out. */
+void
+buffer_copy(buffer *buf, isize begin, isize end, char *out) {
+	buffer_iter it = buffer_iter_begin(buf, begin, end);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk); out += chunk.length) {
+		memcpy(out, chunk.data, (size_t)chunk.length);
+	}
+}
+
+static void
+move_gap(buffer *buf, isize at) {
+	isize  length = buffer_length(buf);
+	isize *front  = buf->lines.data;
+	isize *back   = buf->lines.data + buf->lines.capacity;
+
+	if(at < buf->gap_begin) {
+		isize n = buf->gap_begin - at;
+		memmove(buf->runes + buf->gap_end - n, buf->runes + at, (size_t)n);
+		buf->gap_begin -= n;
+		buf->gap_end   -= n;
+
+		while(buf->lines.front && front[buf->lines.front - 1] >= at) {
+			back[-++buf->lines.back] = length - front[--buf->lines.front];
+		}
+	} else if(at > buf->gap_begin) {
+		isize n = at - buf->gap_begin;
+		memmove(buf->runes + buf->gap_begin, buf->runes + buf->gap_end, (size_t)n);
+		buf->gap_begin += n;
+		buf->gap_end   += n;
+
+		while(buf->lines.back && length - back[-buf->lines.back] < at) {
+			front[buf->lines.front++] = length - back[-buf->lines.back--];
+		}
+	}
+}
+
+/* Makes room for at least n runes in the gap. */
+static void
+grow_gap(buffer *buf, isize n) {
+	if(buf->gap_end - buf->gap_begin >= n) {
+		return;
+	}
+
+	isize tail     = buf->capacity - buf->gap_end;
+	isize capacity = 2 * buf->capacity;
+
+	if(capacity < buffer_length(buf) + n + GAP_MIN) {
+		capacity = buffer_length(buf) + n + GAP_MIN;
+	}
+
+	char *runes = realloc(buf->runes, (size_t)capacity);
+	assert(runes);
+	memmove(runes + capacity - tail, runes + buf->gap_end, (size_t)tail);
+	buf->runes    = runes;
+	buf->gap_end  = capacity - tail;
+	buf->capacity = capacity;
+}
+
+/* Adds the newlines of runes inserted at the gap, which is at position at, to the index. */
+static void
+index_lines(buffer *buf, isize at, s8 runes) {
+	for(isize i = scan_newline(runes.data, runes.length); i < runes.length; i += 1 + scan_newline(runes.data + i + 1, runes.length - i - 1)) {
+		if(buf->lines.front + buf->lines.back == buf->lines.capacity) {
+			isize  capacity = buf->lines.capacity ? 2 * buf->lines.capacity : 1024;
+			isize *data     = realloc(buf->lines.data, (size_t)capacity * sizeof(isize));
+			assert(data);
+			memmove(data + capacity - buf->lines.back, data + buf->lines.capacity - buf->lines.back, (size_t)buf->lines.back * sizeof(isize));
+			buf->lines.data = data;
+			buf->lines.capacity = capacity;
+		}
+
+		buf->lines.data[buf->lines.front++] = at + i;
+	}
+}
+
+/* Returns the position of newline number k, counting from 0. */
+static isize
+newline(buffer *buf, isize k) {
+	if(k < buf->lines.front) {
+		return buf->lines.data[k];
+	}
+
+	isize *back = buf->lines.data + buf->lines.capacity - buf->lines.back;
+	return buffer_length(buf) - back[k - buf->lines.front];
 }
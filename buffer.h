@@ -10,7 +10,33 @@ typedef struct {
 	int line;
 } line_info;
 
+/*
+ * Walks the runes in [pos, end) as contiguous chunks that point into the
+ * buffer. Any edit to the buffer invalidates the iterator and its chunks.
+ */
+typedef struct {
+	buffer *buf;
+	isize   pos;
+	isize   end;
+	isize   index; // Where the backend finds the next chunk
+} buffer_iter;
+
 buffer     *buffer_new(arena*);
+
+/*
+ * buffer_open keeps the number of bytes of the file it has read in *read, if
+ * read is not 0. It is updated atomically, so another thread may watch it.
+ */
+buffer     *buffer_open(arena*, const char*, isize*);
+b32         buffer_save(buffer*, const char*);
+
+/*
+ * A snapshot is a copy of the buffer that is never edited, sharing the runes
+ * where the backend allows it. It may be read on another thread with
+ * buffer_length, buffer_get, buffer_read, the iterator and buffer_copy while
+ * the buffer is edited, and is freed with buffer_free.
+ */
+buffer     *buffer_snapshot(buffer*);
 void        buffer_free(buffer*);
 void        buffer_insert_runes(buffer*, isize, s8);
 void        buffer_delete_runes(buffer*, isize, isize);
@@ -19,6 +45,12 @@ isize       buffer_eol(buffer*, isize);
 isize       buffer_length(buffer*);
 int         buffer_get(buffer*, isize);
 line_info   buffer_line_info(buffer*, isize);
-const char *buffer_read(buffer*, uint32_t, uint32_t*);
+isize       buffer_line_count(buffer*);
+isize       buffer_line_begin(buffer*, isize);
+isize       buffer_line_at(buffer*, isize);
+const char *buffer_read(buffer*, isize, isize*);
+buffer_iter buffer_iter_begin(buffer*, isize, isize);
+b32         buffer_iter_next(buffer_iter*, s8*);
+void        buffer_copy(buffer*, isize, isize, char*);
 
 #endif // BED_BUFFER_H
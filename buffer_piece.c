@@ -0,0 +1,690 @@
+#include "buffer.h"
+#include "scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * A piece table. The file is mapped read-only and never copied, inserted runes
+ * are appended to the add buffer and the buffer contents are the concatenation
+ * of the pieces. A piece points either into the mapping or into the add buffer.
+ *
+ * Every source of runes keeps the offsets of its newlines, and every piece
+ * knows its position and how many newlines precede it. Both lookups by
+ * position and by line are then binary searches. buffer_open indexes the
+ * newlines of the mapping, which load.c does on its thread while the preview
+ * is shown, and buffer_save makes the index of the saved file from the
+ * pieces, so no query has to read the file.
+ *
+ * Runes never move once they are in a source, so a snapshot is a copy of the
+ * pieces that keeps the sources alive. The sources are freed with the last
+ * buffer referencing them.
+ */
+typedef struct {
+	char  *data;
+	isize  length;
+	isize  lines;  // Newlines in the piece
+	isize  pos;    // Buffer position of the first rune
+	isize  line;   // Newlines before the first rune
+	isize  source; // Index of the source the runes are in
+} piece;
+
+typedef struct {
+	char  *data;
+	isize  length;
+	isize  capacity;
+	struct {
+		isize *data;
+		isize  length;
+		isize  capacity;
+	} newlines; // Offsets of the newlines in data
+} source;
+
+typedef struct {
+	isize refs;   // Buffers using the sources, updated atomically
+	struct {
+		source *data;
+		isize   length;
+		isize   capacity;
+	} sources;    // The mapped file, followed by the blocks of the add buffer
+	char *backup; // Where a save moved the mapped file, removed with the mapping
+} storage;
+
+struct buffer {
+	storage *store;
+	struct {
+		piece *data;
+		isize  length;
+		isize  capacity;
+	} pieces;
+	isize length;
+	isize lines;
+};
+
+#define ADD_BLOCK_SIZE (1024 * 1024)
+#define INDEX_STEP     (1024 * 1024) // Bytes of the mapping indexed between updates of *read
+
+static b32   resolve(const char*, char*, isize);
+static b32   replace(buffer*, const char*, const char*);
+static b32   map_file(const char*, s8*);
+static void  unmap_file(s8);
+static void  release(storage*);
+static void  reset(buffer*, source);
+static void  index_source(source*, isize, isize);
+static void  index_pieces(buffer*, source*);
+static isize rank(source*, isize);
+static isize find_piece(buffer*, isize);
+static isize split_piece(buffer*, isize);
+static void  insert_piece(buffer*, isize, piece);
+static void  update_pieces(buffer*, isize);
+static piece append(buffer*, s8);
+static isize newline(buffer*, isize);
+
+buffer*
+buffer_new(arena *arena) {
+	buffer *buf = calloc(1, sizeof(buffer));
+
+	if(buf) {
+		reset(buf, (source) {0});
+	}
+
+	return buf;
+}
+
+buffer*
+buffer_open(arena *arena, const char *file_path, isize *read) {
+	s8 mapping;
+
+	if(!map_file(file_path, &mapping)) {
+		return 0;
+	}
+
+	buffer *buf      = calloc(1, sizeof(buffer));
+	source  original = { .data = mapping.data, .length = mapping.length, .capacity = mapping.length };
+
+	if(!buf) {
+		unmap_file(mapping);
+		return 0;
+	}
+
+	// Indexing pages the whole file in, so it counts as reading it
+	for(isize from = 0, to; from < original.length; from = to) {
+		to = from + INDEX_STEP < original.length ? from + INDEX_STEP : original.length;
+		index_source(&original, from, to);
+
+		if(read) {
+			__atomic_store_n(read, to, __ATOMIC_RELAXED);
+		}
+	}
+
+	reset(buf, original);
+	return buf;
+}
+
+/*
+ * The original file cannot be truncated while it is mapped, so the buffer is
+ * written to a temporary file that then replaces the original. Only once it
+ * has is the saved file mapped as a single piece, so a buffer whose file could
+ * not be replaced keeps its pieces. A symlink is followed to the file it
+ * points to, and the temporary file takes the mode and owner of the original.
+ */
+b32
+buffer_save(buffer *buf, const char *file_path) {
+	char real_path[4096];
+	char tmp_path[4096 + 4];
+
+	if(!resolve(file_path, real_path, sizeof(real_path))) {
+		return 0;
+	}
+
+#ifndef _WIN32
+	struct stat st;
+	b32 exists = !stat(real_path, &st);
+
+	// A file that could not be written in place is not replaced either
+	if(exists && access(real_path, W_OK)) {
+		return 0;
+	}
+#endif
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", real_path);
+	FILE *file = fopen(tmp_path, "wb");
+
+	if(!file) {
+		return 0;
+	}
+
+#ifndef _WIN32
+	// Only root can give a file away, so the owner is kept where it can be
+	if(exists && ((fchown(fileno(file), st.st_uid, st.st_gid) && errno != EPERM) || fchmod(fileno(file), st.st_mode & 07777))) {
+		fclose(file);
+		remove(tmp_path);
+		return 0;
+	}
+#endif
+
+	for(isize i = 0; i < buf->pieces.length; ++i) {
+		piece p = buf->pieces.data[i];
+
+		if(fwrite(p.data, 1, (size_t)p.length, file) < (size_t)p.length) {
+			fclose(file);
+			remove(tmp_path);
+			return 0;
+		}
+	}
+
+	if(fclose(file) || !replace(buf, tmp_path, real_path)) {
+		remove(tmp_path);
+		return 0;
+	}
+
+	// The file is saved either way, and the pieces still hold the same runes
+	s8 mapping;
+
+	if(map_file(real_path, &mapping) && mapping.length == buf->length) {
+		source saved = { .data = mapping.data, .length = mapping.length, .capacity = mapping.length };
+		index_pieces(buf, &saved);
+		reset(buf, saved);
+	} else {
+		unmap_file(mapping);
+	}
+
+	return 1;
+}
+
+buffer*
+buffer_snapshot(buffer *buf) {
+	buffer *snap = calloc(1, sizeof(buffer));
+
+	if(!snap || !(snap->pieces.data = malloc((size_t)(buf->pieces.length + 1) * sizeof(piece)))) {
+		free(snap);
+		return 0;
+	}
+
+	memcpy(snap->pieces.data, buf->pieces.data, (size_t)buf->pieces.length * sizeof(piece));
+	snap->pieces.length = snap->pieces.capacity = buf->pieces.length;
+	snap->store   = buf->store;
+	snap->length  = buf->length;
+	snap->lines   = buf->lines;
+	__atomic_add_fetch(&buf->store->refs, 1, __ATOMIC_RELAXED);
+	return snap;
+}
+
+void
+buffer_free(buffer *buf) {
+	release(buf->store);
+	free(buf->pieces.data);
+	free(buf);
+}
+
+void
+buffer_insert_runes(buffer *buf, isize at, s8 runes) {
+	if(runes.length) {
+		assert(at <= buf->length);
+		isize i = split_piece(buf, at);
+		piece *prev = i ? buf->pieces.data + i - 1 : 0;
+		piece added = append(buf, runes);
+
+		if(prev && prev->source == added.source && prev->data + prev->length == added.data) {
+			// Typing appends to the piece that was inserted last
+			prev->length += added.length;
+			prev->lines  += added.lines;
+			update_pieces(buf, i);
+		} else {
+			insert_piece(buf, i, added);
+			update_pieces(buf, i);
+		}
+	}
+}
+
+void
+buffer_delete_runes(buffer *buf, isize begin, isize end) {
+	if(begin < end) {
+		assert(end <= buf->length);
+		isize first = split_piece(buf, begin);
+		isize last  = split_piece(buf, end);
+		piece *data = buf->pieces.data;
+		memmove(data + first, data + last, (size_t)(buf->pieces.length - last) * sizeof(*data));
+		buf->pieces.length -= last - first;
+		update_pieces(buf, first);
+	}
+}
+
+isize
+buffer_bol(buffer *buf, isize pos) {
+	return buffer_line_begin(buf, buffer_line_at(buf, pos));
+}
+
+isize
+buffer_eol(buffer *buf, isize pos) {
+	isize line = buffer_line_at(buf, pos);
+	return line < buf->lines ? newline(buf, line) : buf->length;
+}
+
+isize
+buffer_length(buffer *buf) {
+	return buf->length;
+}
+
+int
+buffer_get(buffer *buf, isize pos) {
+	if(pos >= buf->length) {
+		return -1;
+	}
+
+	piece *p = buf->pieces.data + find_piece(buf, pos);
+	return p->data[pos - p->pos] & 0xFF;
+}
+
+line_info
+buffer_line_info(buffer *buf, isize at) {
+	isize line = buffer_line_at(buf, at);
+	return (line_info) {
+		.line = (int)line + 1,
+		.col  = (int)(at - buffer_line_begin(buf, line)) + 1,
+	};
+}
+
+isize
+buffer_line_count(buffer *buf) {
+	return buf->lines + 1;
+}
+
+isize
+buffer_line_begin(buffer *buf, isize line) {
+	return line ? newline(buf, line - 1) + 1 : 0;
+}
+
+isize
+buffer_line_at(buffer *buf, isize pos) {
+	if(pos >= buf->length) {
+		return buf->lines;
+	}
+
+	piece  *p   = buf->pieces.data + find_piece(buf, pos);
+	source *src = buf->store->sources.data + p->source;
+	isize   off = p->data - src->data;
+	return p->line + rank(src, off + pos - p->pos) - rank(src, off);
+}
+
+/* Returns the rest of the piece at byte_index. */
+const char*
+buffer_read(buffer *buf, isize byte_index, isize *bytes_read) {
+	if(byte_index >= buf->length) {
+		*bytes_read = 0;
+		return "";
+	}
+
+	piece *p = buf->pieces.data + find_piece(buf, byte_index);
+	*bytes_read = p->length - (byte_index - p->pos);
+	return p->data + byte_index - p->pos;
+}
+
+buffer_iter
+buffer_iter_begin(buffer *buf, isize begin, isize end) {
+	assert(0 <= begin && begin <= end && end <= buf->length);
+	return (buffer_iter) { buf, begin, end, find_piece(buf, begin) };
+}
+
+/* Yields the pieces in order, index being the next one. */
+b32
+buffer_iter_next(buffer_iter *it, s8 *chunk) {
+	if(it->pos >= it->end) {
+		return 0;
+	}
+
+	piece *p      = it->buf->pieces.data + it->index++;
+	isize  stop   = p->pos + p->length;
+	chunk->data   = p->data + it->pos - p->pos;
+	chunk->length = (it->end < stop ? it->end : stop) - it->pos;
+	it->pos      += chunk->length;
+	return 1;
+}
+
+/* Copies the runes in [begin, end) to out. */
+void
+buffer_copy(buffer *buf, isize begin, isize end, char *out) {
+	buffer_iter it = buffer_iter_begin(buf, begin, end);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk); out += chunk.length) {
+		memcpy(out, chunk.data, (size_t)chunk.length);
+	}
+}
+
+/* Follows symlinks to the file that is really written, which may not exist yet. */
+static b32
+resolve(const char *file_path, char *real_path, isize size) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+
+	if(file == INVALID_HANDLE_VALUE) {
+		return GetLastError() == ERROR_FILE_NOT_FOUND && snprintf(real_path, (size_t)size, "%s", file_path) < size;
+	}
+
+	DWORD length = GetFinalPathNameByHandleA(file, real_path, (DWORD)size, FILE_NAME_NORMALIZED);
+	CloseHandle(file);
+	return length && length < size;
+#else
+	char *real = realpath(file_path, 0);
+
+	if(!real) {
+		return errno == ENOENT && snprintf(real_path, (size_t)size, "%s", file_path) < size;
+	}
+
+	b32 fits = snprintf(real_path, (size_t)size, "%s", real) < size;
+	free(real);
+	return fits;
+#endif
+}
+
+/*
+ * Moves tmp_path over file_path. Windows cannot replace or delete a file
+ * while it is mapped, but it can rename it, so ReplaceFile moves the original
+ * aside, keeping its attributes and security on the new file, and the
+ * original is removed once nothing maps it.
+ */
+static b32
+replace(buffer *buf, const char *tmp_path, const char *file_path) {
+#ifdef _WIN32
+	char backup[4096 + 4];
+	snprintf(backup, sizeof(backup), "%s.old", file_path);
+
+	if(GetFileAttributesA(file_path) == INVALID_FILE_ATTRIBUTES) {
+		return MoveFileExA(tmp_path, file_path, MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	if(!ReplaceFileA(file_path, tmp_path, backup, REPLACEFILE_IGNORE_MERGE_ERRORS, 0, 0)) {
+		return 0;
+	}
+
+	if(!DeleteFileA(backup)) {
+		free(buf->store->backup);
+		buf->store->backup = strdup(backup);
+	}
+
+	return 1;
+#else
+	return rename(tmp_path, file_path) == 0;
+#endif
+}
+
+static b32
+map_file(const char *file_path, s8 *map) {
+	*map = (s8) {0};
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	LARGE_INTEGER size;
+
+	if(file == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+
+	if(!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return 0;
+	}
+
+	if(size.QuadPart) {
+		HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+
+		if(mapping) {
+			map->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			map->length = map->data ? (isize)size.QuadPart : 0;
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+	return !size.QuadPart || map->data;
+#else
+	int fd = open(file_path, O_RDONLY);
+	struct stat st;
+
+	if(fd < 0) {
+		return 0;
+	}
+
+	if(fstat(fd, &st)) {
+		close(fd);
+		return 0;
+	}
+
+	if(st.st_size) {
+		void *data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(data != MAP_FAILED) {
+			map->data = data;
+			map->length = st.st_size;
+		}
+	}
+
+	close(fd);
+	return !st.st_size || map->data;
+#endif
+}
+
+static void
+unmap_file(s8 map) {
+	if(map.data) {
+#ifdef _WIN32
+		UnmapViewOfFile(map.data);
+#else
+		munmap(map.data, (size_t)map.length);
+#endif
+	}
+}
+
+static void
+release(storage *store) {
+	if(!store || __atomic_sub_fetch(&store->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	source *original = store->sources.data;
+	unmap_file((s8) { original->length, original->data });
+
+	if(store->backup) {
+		remove(store->backup);
+		free(store->backup);
+	}
+
+	for(isize i = 0; i < store->sources.length; ++i) {
+		if(i) free(store->sources.data[i].data);
+		free(store->sources.data[i].newlines.data);
+	}
+
+	free(store->sources.data);
+	free(store);
+}
+
+/* Drops every source and makes the buffer a single piece of original, whose newlines are indexed. */
+static void
+reset(buffer *buf, source original) {
+	release(buf->store);
+	buf->store = calloc(1, sizeof(storage));
+	assert(buf->store);
+	buf->store->refs = 1;
+	*push(&buf->store->sources) = original;
+	buf->pieces.length = 0;
+	buf->length = original.length;
+	buf->lines  = original.newlines.length;
+
+	if(original.length) {
+		*push(&buf->pieces) = (piece) { .data = original.data, .length = original.length, .lines = buf->lines };
+	}
+}
+
+/* Adds the newlines in src->data[from, to) to its index. */
+static void
+index_source(source *src, isize from, isize to) {
+	for(isize i = from + scan_newline(src->data + from, to - from); i < to; i += 1 + scan_newline(src->data + i + 1, to - i - 1)) {
+		*push(&src->newlines) = i;
+	}
+}
+
+/* Indexes the newlines of saved, which holds the runes of the pieces, from the indexes of their sources. */
+static void
+index_pieces(buffer *buf, source *saved) {
+	for(isize i = 0; i < buf->pieces.length; ++i) {
+		piece  *p     = buf->pieces.data + i;
+		source *src   = buf->store->sources.data + p->source;
+		isize   off   = p->data - src->data;
+		isize   first = rank(src, off);
+
+		for(isize k = first; k < first + p->lines; ++k) {
+			*push(&saved->newlines) = src->newlines.data[k] - off + p->pos;
+		}
+	}
+}
+
+/* Returns the number of newlines in src before offset. */
+static isize
+rank(source *src, isize offset) {
+	isize lo = 0;
+	isize hi = src->newlines.length;
+
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+
+		if(src->newlines.data[mid] < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* Returns the index of the piece containing pos, or the number of pieces if pos is the end. */
+static isize
+find_piece(buffer *buf, isize pos) {
+	isize lo = 0;
+	isize hi = buf->pieces.length;
+
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+		piece *p  = buf->pieces.data + mid;
+
+		if(p->pos + p->length <= pos) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* Makes sure a piece begins at pos and returns its index. */
+static isize
+split_piece(buffer *buf, isize pos) {
+	isize i = find_piece(buf, pos);
+
+	if(i < buf->pieces.length && buf->pieces.data[i].pos < pos) {
+		piece  *p   = buf->pieces.data + i;
+		source *src = buf->store->sources.data + p->source;
+		isize   off = p->data - src->data;
+		isize   n   = pos - p->pos;
+		piece   tail = *p;
+
+		p->length = n;
+		p->lines  = rank(src, off + n) - rank(src, off);
+		tail.data   += n;
+		tail.length -= n;
+		tail.lines  -= p->lines;
+		tail.pos    += n;
+		tail.line   += p->lines;
+		insert_piece(buf, ++i, tail);
+	}
+
+	return i;
+}
+
+static void
+insert_piece(buffer *buf, isize i, piece p) {
+	push(&buf->pieces);
+	piece *data = buf->pieces.data;
+	memmove(data + i + 1, data + i, (size_t)(buf->pieces.length - 1 - i) * sizeof(*data));
+	data[i] = p;
+}
+
+/* Recomputes the positions and line numbers of the pieces from i on. */
+static void
+update_pieces(buffer *buf, isize i) {
+	piece *data = buf->pieces.data;
+	isize  pos  = i ? data[i - 1].pos  + data[i - 1].length : 0;
+	isize  line = i ? data[i - 1].line + data[i - 1].lines  : 0;
+
+	for(; i < buf->pieces.length; ++i) {
+		data[i].pos  = pos;
+		data[i].line = line;
+		pos  += data[i].length;
+		line += data[i].lines;
+	}
+
+	buf->length = pos;
+	buf->lines  = line;
+}
+
+/* Copies runes to the add buffer. Added runes never move. */
+static piece
+append(buffer *buf, s8 runes) {
+	source *block = buf->store->sources.data + buf->store->sources.length - 1;
+
+	if(buf->store->sources.length == 1 || block->capacity - block->length < runes.length) {
+		block = push(&buf->store->sources);
+		*block = (source) {0};
+		block->capacity = runes.length > ADD_BLOCK_SIZE ? runes.length : ADD_BLOCK_SIZE;
+		block->data = malloc((size_t)block->capacity);
+		assert(block->data);
+	}
+
+	piece added = {
+		.data   = block->data + block->length,
+		.length = runes.length,
+		.source = block - buf->store->sources.data,
+	};
+	isize newlines = block->newlines.length;
+	memcpy(added.data, runes.data, (size_t)runes.length);
+	block->length += runes.length;
+	index_source(block, block->length - runes.length, block->length);
+	added.lines = block->newlines.length - newlines;
+	return added;
+}
+
+/* Returns the position of newline number k, counting from 0. */
+static isize
+newline(buffer *buf, isize k) {
+	isize lo = 0;
+	isize hi = buf->pieces.length;
+
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+		piece *p  = buf->pieces.data + mid;
+
+		if(p->line + p->lines <= k) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	assert(lo < buf->pieces.length);
+	piece  *p   = buf->pieces.data + lo;
+	source *src = buf->store->sources.data + p->source;
+	isize   off = p->data - src->data;
+	return p->pos + src->newlines.data[rank(src, off) + k - p->line] - off;
+}
@@ -0,0 +1,615 @@
+#include "buffer.h"
+#include "scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A rope stored as a B-tree. The runes live in leaves of at most LEAF_SIZE
+ * runes and every inner node keeps the rune and newline counts of each of its
+ * children, so finding a position, the line of a position or the position of
+ * a line is a walk from the root.
+ * All leaves are at the same depth and memory grows with the contents.
+ *
+ * Nodes are reference counted so that a snapshot only shares the root. An
+ * edit copies every shared node on its path before changing it, so the nodes
+ * a snapshot sees never change.
+ */
+#define LEAF_SIZE 4096
+#define FANOUT    32
+
+typedef struct {
+	isize length; // Runes in the subtree
+	isize lines;  // Newlines in the subtree
+} summary;
+
+typedef struct node node;
+struct node {
+	int height; // 0 for a leaf
+	int count;  // Runes in a leaf, children in an inner node
+	int refs;   // Owners of the node, updated atomically
+};
+
+typedef struct {
+	node hdr;
+	char runes[LEAF_SIZE];
+} leaf;
+
+typedef struct {
+	node    hdr;
+	node   *child[FANOUT];
+	summary sum[FANOUT];
+} inner;
+
+struct buffer {
+	node   *root;
+	summary total;
+	leaf   *cache;     // Leaf last looked up
+	isize   cache_pos; // Buffer position of its first rune
+};
+
+static leaf   *new_leaf(void);
+static inner  *new_inner(int);
+static void    retain(node*);
+static void    release(node*);
+static node   *unique(node**);
+static summary node_summary(node*);
+static leaf   *find_leaf(buffer*, isize, isize*);
+static isize   newline(buffer*, isize);
+static node   *insert(node**, summary*, isize, s8, summary*);
+static void    delete(node**, summary*, isize, isize);
+
+buffer*
+buffer_new(arena *arena) {
+	buffer *buf = calloc(1, sizeof(buffer));
+
+	if(buf && !(buf->root = (node*)new_leaf())) {
+		free(buf);
+		return 0;
+	}
+
+	return buf;
+}
+
+buffer*
+buffer_open(arena *arena, const char *file_path, isize *read) {
+	FILE   *file = fopen(file_path, "rb");
+	buffer *buf  = file ? buffer_new(arena) : 0;
+	char    chunk[LEAF_SIZE];
+
+	if(!buf) {
+		goto FAIL;
+	}
+
+	// Appending a full chunk keeps the leaf before it full
+	while(!feof(file)) {
+		s8 runes = { (isize)fread(chunk, 1, sizeof(chunk), file), chunk };
+
+		if(ferror(file)) {
+			goto FAIL;
+		}
+
+		buffer_insert_runes(buf, buf->total.length, runes);
+
+		if(read) {
+			__atomic_store_n(read, buf->total.length, __ATOMIC_RELAXED);
+		}
+	}
+
+	fclose(file);
+	return buf;
+
+FAIL:
+	if(file) fclose(file);
+	if(buf)  buffer_free(buf);
+	return 0;
+}
+
+b32
+buffer_save(buffer *buf, const char *file_path) {
+	FILE *file = fopen(file_path, "wb");
+
+	if(!file) {
+		return 0;
+	}
+
+	b32 ok = 1;
+	buffer_iter it = buffer_iter_begin(buf, 0, buf->total.length);
+
+	for(s8 chunk; ok && buffer_iter_next(&it, &chunk);) {
+		ok = fwrite(chunk.data, 1, (size_t)chunk.length, file) == (size_t)chunk.length;
+	}
+
+	return !fclose(file) && ok;
+}
+
+buffer*
+buffer_snapshot(buffer *buf) {
+	buffer *snap = malloc(sizeof(buffer));
+
+	if(snap) {
+		*snap = *buf;
+		snap->cache = 0;
+		retain(buf->root);
+	}
+
+	return snap;
+}
+
+void
+buffer_free(buffer *buf) {
+	release(buf->root);
+	free(buf);
+}
+
+void
+buffer_insert_runes(buffer *buf, isize at, s8 runes) {
+	assert(at <= buf->total.length);
+	buf->cache = 0;
+
+	for(isize done = 0; done < runes.length;) {
+		s8 chunk = { runes.length - done, runes.data + done };
+		chunk.length = chunk.length < LEAF_SIZE ? chunk.length : LEAF_SIZE;
+
+		summary split_sum;
+		node *split = insert(&buf->root, &buf->total, at + done, chunk, &split_sum);
+
+		if(split) {
+			inner *root = new_inner(buf->root->height + 1);
+			root->hdr.count = 2;
+			root->child[0] = buf->root;
+			root->child[1] = split;
+			root->sum[0] = buf->total;
+			root->sum[1] = split_sum;
+			buf->root = (node*)root;
+			buf->total = node_summary(buf->root);
+		}
+
+		done += chunk.length;
+	}
+}
+
+void
+buffer_delete_runes(buffer *buf, isize begin, isize end) {
+	if(begin < end) {
+		assert(end <= buf->total.length);
+		buf->cache = 0;
+		delete(&buf->root, &buf->total, begin, end);
+
+		// Only the first root is sure to be unique, a snapshot may share the rest
+		while(buf->root->height && buf->root->count <= 1) {
+			inner *root = (inner*)buf->root;
+			buf->root = root->hdr.count ? root->child[0] : (node*)new_leaf();
+
+			if(root->hdr.count) {
+				retain(buf->root);
+			}
+
+			release((node*)root);
+		}
+	}
+}
+
+isize
+buffer_bol(buffer *buf, isize pos) {
+	return buffer_line_begin(buf, buffer_line_at(buf, pos));
+}
+
+isize
+buffer_eol(buffer *buf, isize pos) {
+	isize line = buffer_line_at(buf, pos);
+	return line < buf->total.lines ? newline(buf, line) : buf->total.length;
+}
+
+isize
+buffer_length(buffer *buf) {
+	return buf->total.length;
+}
+
+int
+buffer_get(buffer *buf, isize pos) {
+	if(pos >= buf->total.length) {
+		return -1;
+	}
+
+	isize start;
+	leaf *l = find_leaf(buf, pos, &start);
+	return l->runes[pos - start] & 0xFF;
+}
+
+line_info
+buffer_line_info(buffer *buf, isize at) {
+	isize line = buffer_line_at(buf, at);
+	return (line_info) {
+		.line = (int)line + 1,
+		.col  = (int)(at - buffer_line_begin(buf, line)) + 1,
+	};
+}
+
+isize
+buffer_line_count(buffer *buf) {
+	return buf->total.lines + 1;
+}
+
+isize
+buffer_line_begin(buffer *buf, isize line) {
+	return line ? newline(buf, line - 1) + 1 : 0;
+}
+
+isize
+buffer_line_at(buffer *buf, isize pos) {
+	isize lines = 0;
+	node *n     = buf->root;
+
+	while(n->height) {
+		inner *in = (inner*)n;
+		int i = 0;
+
+		for(; i < n->count - 1 && pos >= in->sum[i].length; ++i) {
+			pos   -= in->sum[i].length;
+			lines += in->sum[i].lines;
+		}
+
+		n = in->child[i];
+	}
+
+	return lines + scan_count_newlines(((leaf*)n)->runes, pos);
+}
+
+/* Returns the rest of the leaf at byte_index. */
+const char*
+buffer_read(buffer *buf, isize byte_index, isize *bytes_read) {
+	if(byte_index >= buf->total.length) {
+		*bytes_read = 0;
+		return "";
+	}
+
+	isize start;
+	leaf *l = find_leaf(buf, byte_index, &start);
+	*bytes_read = l->hdr.count - (byte_index - start);
+	return l->runes + byte_index - start;
+}
+
+buffer_iter
+buffer_iter_begin(buffer *buf, isize begin, isize end) {
+	assert(0 <= begin && begin <= end && end <= buf->total.length);
+	return (buffer_iter) { buf, begin, end, 0 };
+}
+
+/* Yields the leaves in order, descending from the root for each one. */
+b32
+buffer_iter_next(buffer_iter *it, s8 *chunk) {
+	if(it->pos >= it->end) {
+		return 0;
+	}
+
+	isize start;
+	leaf *l       = find_leaf(it->buf, it->pos, &start);
+	isize stop    = start + l->hdr.count;
+	chunk->data   = l->runes + it->pos - start;
+	chunk->length = (it->end < stop ? it->end : stop) - it->pos;
+	it->pos      += chunk->length;
+	return 1;
+}
+
+/* Copies the runes in [begin, end) to out. */
+void
+buffer_copy(buffer *buf, isize begin, isize end, char *out) {
+	buffer_iter it = buffer_iter_begin(buf, begin, end);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk); out += chunk.length) {
+		memcpy(out, chunk.data, (size_t)chunk.length);
+	}
+}
+
+static leaf*
+new_leaf(void) {
+	leaf *l = calloc(1, sizeof(leaf));
+
+	if(l) {
+		l->hdr.refs = 1;
+	}
+
+	return l;
+}
+
+static inner*
+new_inner(int height) {
+	inner *in = calloc(1, sizeof(inner));
+	assert(in);
+	in->hdr.height = height;
+	in->hdr.refs = 1;
+	return in;
+}
+
+static void
+retain(node *n) {
+	__atomic_add_fetch(&n->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void
+release(node *n) {
+	if(__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	if(n->height) {
+		for(int i = 0; i < n->count; ++i) {
+			release(((inner*)n)->child[i]);
+		}
+	}
+
+	free(n);
+}
+
+/* Replaces *n with a private copy if it is shared and returns it. */
+static node*
+unique(node **n) {
+	if(__atomic_load_n(&(*n)->refs, __ATOMIC_ACQUIRE) == 1) {
+		return *n;
+	}
+
+	size_t size = (*n)->height ? sizeof(inner) : sizeof(leaf);
+	node  *copy = malloc(size);
+	assert(copy);
+	memcpy(copy, *n, size);
+	copy->refs = 1;
+
+	if(copy->height) {
+		for(int i = 0; i < copy->count; ++i) {
+			retain(((inner*)copy)->child[i]);
+		}
+	}
+
+	release(*n);
+	*n = copy;
+	return copy;
+}
+
+static summary
+node_summary(node *n) {
+	summary sum = {0};
+
+	if(n->height) {
+		for(int i = 0; i < n->count; ++i) {
+			sum.length += ((inner*)n)->sum[i].length;
+			sum.lines  += ((inner*)n)->sum[i].lines;
+		}
+	} else {
+		sum.length = n->count;
+		sum.lines  = scan_count_newlines(((leaf*)n)->runes, n->count);
+	}
+
+	return sum;
+}
+
+/*
+ * Returns the leaf containing pos and stores the position of its first rune in start.
+ * The end of the buffer is in the last leaf.
+ */
+static leaf*
+find_leaf(buffer *buf, isize pos, isize *start) {
+	if(buf->cache && buf->cache_pos <= pos && pos < buf->cache_pos + buf->cache->hdr.count) {
+		*start = buf->cache_pos;
+		return buf->cache;
+	}
+
+	node *n = buf->root;
+	isize p = 0;
+
+	while(n->height) {
+		inner *in = (inner*)n;
+		int i = 0;
+
+		for(; i < n->count - 1 && pos - p >= in->sum[i].length; ++i) {
+			p += in->sum[i].length;
+		}
+
+		n = in->child[i];
+	}
+
+	buf->cache = (leaf*)n;
+	buf->cache_pos = p;
+	*start = p;
+	return (leaf*)n;
+}
+
+/* Returns the position of newline number k, counting from 0. */
+static isize
+newline(buffer *buf, isize k) {
+	node *n   = buf->root;
+	isize pos = 0;
+
+	while(n->height) {
+		inner *in = (inner*)n;
+		int i = 0;
+
+		for(; i < n->count - 1 && k >= in->sum[i].lines; ++i) {
+			k   -= in->sum[i].lines;
+			pos += in->sum[i].length;
+		}
+
+		n = in->child[i];
+	}
+
+	char *runes = ((leaf*)n)->runes;
+	isize i     = scan_newline(runes, n->count);
+
+	for(; k; --k) {
+		i += 1 + scan_newline(runes + i + 1, n->count - i - 1);
+	}
+
+	assert(i < n->count);
+	return pos + i;
+}
+
+/*
+ * Inserts at most LEAF_SIZE runes at pos in the subtree n summarized by sum.
+ * If n overflows it is split and the new right sibling is returned and summarized
+ * by split_sum.
+ */
+static node*
+insert(node **np, summary *sum, isize pos, s8 runes, summary *split_sum) {
+	node *n = unique(np);
+
+	if(!n->height) {
+		leaf *l = (leaf*)n;
+
+		if(n->count + runes.length <= LEAF_SIZE) {
+			memmove(l->runes + pos + runes.length, l->runes + pos, (size_t)(n->count - pos));
+			memcpy(l->runes + pos, runes.data, (size_t)runes.length);
+			n->count += (int)runes.length;
+			sum->length += runes.length;
+			sum->lines  += scan_count_newlines(runes.data, runes.length);
+			return 0;
+		}
+
+		char  tmp[2 * LEAF_SIZE];
+		isize total = n->count + runes.length;
+		memcpy(tmp, l->runes, (size_t)pos);
+		memcpy(tmp + pos, runes.data, (size_t)runes.length);
+		memcpy(tmp + pos + runes.length, l->runes + pos, (size_t)(n->count - pos));
+
+		// Appending keeps the left leaf full, otherwise split evenly
+		isize left = pos == n->count ? pos : total / 2;
+		leaf *r = new_leaf();
+		assert(r);
+		memcpy(l->runes, tmp, (size_t)left);
+		memcpy(r->runes, tmp + left, (size_t)(total - left));
+		n->count = (int)left;
+		r->hdr.count = (int)(total - left);
+		*sum = node_summary(n);
+		*split_sum = node_summary((node*)r);
+		return (node*)r;
+	}
+
+	inner *in = (inner*)n;
+	int i = 0;
+
+	for(; i < n->count - 1 && pos >= in->sum[i].length; ++i) {
+		pos -= in->sum[i].length;
+	}
+
+	summary child_sum;
+	node *split = insert(in->child + i, in->sum + i, pos, runes, &child_sum);
+
+	if(!split) {
+		sum->length += runes.length;
+		sum->lines  += scan_count_newlines(runes.data, runes.length);
+		return 0;
+	}
+
+	node   *child[FANOUT + 1];
+	summary child_sums[FANOUT + 1];
+	int     total = n->count + 1;
+	memcpy(child, in->child, (size_t)(i + 1) * sizeof(*child));
+	memcpy(child_sums, in->sum, (size_t)(i + 1) * sizeof(*child_sums));
+	child[i + 1] = split;
+	child_sums[i + 1] = child_sum;
+	memcpy(child + i + 2, in->child + i + 1, (size_t)(n->count - i - 1) * sizeof(*child));
+	memcpy(child_sums + i + 2, in->sum + i + 1, (size_t)(n->count - i - 1) * sizeof(*child_sums));
+
+	if(total <= FANOUT) {
+		memcpy(in->child, child, (size_t)total * sizeof(*child));
+		memcpy(in->sum, child_sums, (size_t)total * sizeof(*child_sums));
+		n->count = total;
+		sum->length += runes.length;
+		sum->lines  += scan_count_newlines(runes.data, runes.length);
+		return 0;
+	}
+
+	// Appending keeps the left node full, otherwise split evenly
+	int left = i + 1 == n->count ? n->count : total / 2;
+	inner *r = new_inner(n->height);
+	memcpy(in->child, child, (size_t)left * sizeof(*child));
+	memcpy(in->sum, child_sums, (size_t)left * sizeof(*child_sums));
+	memcpy(r->child, child + left, (size_t)(total - left) * sizeof(*child));
+	memcpy(r->sum, child_sums + left, (size_t)(total - left) * sizeof(*child_sums));
+	n->count = left;
+	r->hdr.count = total - left;
+	*sum = node_summary(n);
+	*split_sum = node_summary((node*)r);
+	return (node*)r;
+}
+
+/* Merges b into *a if it fits, making *a unique first. */
+static b32
+merge(node **ap, summary *a_sum, node *b, summary *b_sum) {
+	if((*ap)->count + b->count > ((*ap)->height ? FANOUT : LEAF_SIZE)) {
+		return 0;
+	}
+
+	node *a = unique(ap);
+
+	if(!a->height) {
+		memcpy(((leaf*)a)->runes + a->count, ((leaf*)b)->runes, (size_t)b->count);
+	} else {
+		memcpy(((inner*)a)->child + a->count, ((inner*)b)->child, (size_t)b->count * sizeof(node*));
+		memcpy(((inner*)a)->sum + a->count, ((inner*)b)->sum, (size_t)b->count * sizeof(summary));
+
+		for(int i = 0; i < b->count; ++i) {
+			retain(((inner*)b)->child[i]);
+		}
+	}
+
+	a->count += b->count;
+	a_sum->length += b_sum->length;
+	a_sum->lines  += b_sum->lines;
+	release(b);
+	return 1;
+}
+
+/* Deletes the runes in [begin, end) of the subtree *np summarized by sum. */
+static void
+delete(node **np, summary *sum, isize begin, isize end) {
+	node *n = unique(np);
+
+	if(!n->height) {
+		leaf *l = (leaf*)n;
+		sum->length -= end - begin;
+		sum->lines  -= scan_count_newlines(l->runes + begin, end - begin);
+		memmove(l->runes + begin, l->runes + end, (size_t)(n->count - end));
+		n->count -= (int)(end - begin);
+		return;
+	}
+
+	inner *in = (inner*)n;
+
+	for(isize i = 0, pos = 0; i < n->count && pos < end;) {
+		isize length = in->sum[i].length;
+		isize b = begin - pos > 0 ? begin - pos : 0;
+		isize e = end - pos < length ? end - pos : length;
+
+		if(b >= e) {
+			i++;
+		} else if(b == 0 && e == length) {
+			release(in->child[i]);
+			memmove(in->child + i, in->child + i + 1, (size_t)(n->count - i - 1) * sizeof(node*));
+			memmove(in->sum + i, in->sum + i + 1, (size_t)(n->count - i - 1) * sizeof(summary));
+			n->count--;
+		} else {
+			delete(in->child + i, in->sum + i, b, e);
+			i++;
+		}
+
+		pos += length;
+	}
+
+	// Merge the children that were left underfull with their right sibling
+	for(int i = 0; i < n->count - 1;) {
+		node *child = in->child[i];
+		node *next  = in->child[i + 1];
+		int   full  = child->height ? FANOUT : LEAF_SIZE;
+
+		if((child->count < full / 2 || next->count < full / 2) && merge(in->child + i, in->sum + i, next, in->sum + i + 1)) {
+			memmove(in->child + i + 1, in->child + i + 2, (size_t)(n->count - i - 2) * sizeof(node*));
+			memmove(in->sum + i + 1, in->sum + i + 2, (size_t)(n->count - i - 2) * sizeof(summary));
+			n->count--;
+		} else {
+			i++;
+		}
+	}
+
+	*sum = node_summary(n);
+}
@@ -87,7 +87,7 @@ buffer_line_info(buffer *buf, isize at) {
 }
 
 const char*
-buffer_read(buffer *buf, uint32_t byte_index, uint32_t *bytes_read) {
-	*bytes_read = (uint32_t)buf->length - byte_index;
+buffer_read(buffer *buf, isize byte_index, isize *bytes_read) {
+	*bytes_read = buf->length - byte_index;
 	return buf->runes + byte_index;
 }
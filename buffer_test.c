@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FAIL(msg) do { \
+	fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, msg); \
+	return 1; \
+} while(0)
+
+/* Checks the buffer contents against str rune by rune, chunk by chunk and by copying. */
+static int
+equals(buffer *buf, const char *str) {
+	isize length = (isize)strlen(str);
+
+	if(buffer_length(buf) != length) {
+		return 0;
+	}
+
+	for(isize i = 0; i < length; ++i) {
+		if(buffer_get(buf, i) != (str[i] & 0xFF)) {
+			return 0;
+		}
+	}
+
+	if(buffer_get(buf, length) != -1) {
+		return 0;
+	}
+
+	static char copy[1 << 20];
+	isize       pos = 0;
+	buffer_iter it  = buffer_iter_begin(buf, 0, length);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk); pos += chunk.length) {
+		if(!chunk.length || memcmp(chunk.data, str + pos, (size_t)chunk.length)) {
+			return 0;
+		}
+	}
+
+	buffer_copy(buf, 0, length, copy);
+
+	if(pos != length || memcmp(copy, str, (size_t)length)) {
+		return 0;
+	}
+
+	for(isize i = 0, n;; i += n) {
+		const char *runes = buffer_read(buf, i, &n);
+
+		if(!n) {
+			return i == length;
+		}
+
+		if(memcmp(runes, str + i, (size_t)n)) {
+			return 0;
+		}
+	}
+}
+
+/* Applies random edits to buf and to a flat copy and compares the two. */
+static int
+random_edits(buffer *buf) {
+	static char flat[1 << 18];
+	static char runes[10000];
+	static char frozen[1 << 18];
+	buffer *snap   = 0;
+	isize   length = 0;
+
+	srand(1);
+
+	for(int n = 0; n < 3000; ++n) {
+		isize at = length ? rand() % (length + 1) : 0;
+
+		if(rand() % 3 && length + (isize)sizeof(runes) < (isize)sizeof(flat)) {
+			isize count = rand() % 8 ? rand() % 16 : rand() % (isize)sizeof(runes);
+
+			for(isize i = 0; i < count; ++i) {
+				runes[i] = (char)(rand() % 8 ? 'a' + rand() % 26 : '\n');
+			}
+
+			memmove(flat + at + count, flat + at, (size_t)(length - at));
+			memcpy(flat + at, runes, (size_t)count);
+			length += count;
+			buffer_insert_runes(buf, at, (s8) { count, runes });
+		} else {
+			isize end = at + (rand() % 8 ? rand() % 16 : rand() % 20000);
+			end = end < length ? end : length;
+			memmove(flat + at, flat + end, (size_t)(length - end));
+			length -= end - at;
+			buffer_delete_runes(buf, at, end);
+		}
+
+		at = length ? rand() % (length + 1) : 0;
+		isize bol = at;
+		isize eol = at;
+		line_info li = { 1, 1 };
+
+		while(bol > 0 && flat[bol - 1] != '\n') bol--;
+		while(eol < length && flat[eol] != '\n') eol++;
+		for(isize i = 0; i < at; ++i) li.line += flat[i] == '\n';
+		li.col += (int)(at - bol);
+
+		line_info got = buffer_line_info(buf, at);
+
+		if(buffer_bol(buf, at) != bol || buffer_eol(buf, at) != eol || got.line != li.line || got.col != li.col) {
+			return 0;
+		}
+
+		isize lines = li.line;
+		for(isize i = at; i < length; ++i) lines += flat[i] == '\n';
+
+		if(buffer_line_count(buf) != lines || buffer_line_at(buf, at) != li.line - 1 || buffer_line_begin(buf, li.line - 1) != bol) {
+			return 0;
+		}
+
+		isize end = at + rand() % (length - at + 1);
+		static char copy[1 << 18];
+		buffer_copy(buf, at, end, copy);
+
+		if(memcmp(copy, flat + at, (size_t)(end - at))) {
+			return 0;
+		}
+
+		if(n % 100 == 0) {
+			flat[length] = 0;
+
+			if(!equals(buf, flat) || (snap && !equals(snap, frozen))) {
+				return 0;
+			}
+
+			// The snapshot must keep its contents through the next 100 edits
+			if(snap) buffer_free(snap);
+			snap = buffer_snapshot(buf);
+			memcpy(frozen, flat, (size_t)length + 1);
+		}
+	}
+
+	// Appending fills the rope's 4096 rune leaves and 32 child nodes, so these
+	// are three full subtrees and a fourth of three leaves. Trimming the fourth
+	// to one leaf and deleting the others collapses the root two levels, onto
+	// nodes the snapshot still shares.
+	static char big[3 * 32 * 4096 + 3 * 4096 + 1];
+	isize       subtree = 32 * 4096;
+	isize       total   = 3 * subtree + 3 * 4096;
+
+	for(isize i = 0; i < total; ++i) {
+		big[i] = (char)(i % 64 ? 'a' + i % 26 : '\n');
+	}
+
+	buffer_delete_runes(buf, 0, buffer_length(buf));
+
+	for(isize i = 0; i < total; i += 1024) {
+		buffer_insert_runes(buf, i, (s8) { 1024, big + i });
+	}
+
+	buffer_delete_runes(buf, 3 * subtree, 3 * subtree + 2 * 4096);
+	memmove(big + 3 * subtree, big + 3 * subtree + 2 * 4096, 4096);
+	big[3 * subtree + 4096] = 0;
+
+	if(snap) buffer_free(snap);
+	snap = buffer_snapshot(buf);
+	buffer_delete_runes(buf, 0, 3 * subtree);
+	buffer_insert_runes(buf, 0, s8("after the collapse\n"));
+
+	if(!equals(snap, big)) {
+		buffer_free(snap);
+		return 0;
+	}
+
+	buffer_free(snap);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	buffer *buf = buffer_new(NULL);
+
+	if(!buf) {
+		FAIL("buffer_new");
+	}
+
+	buffer_insert_runes(buf, 0, s8("world\n"));
+	buffer_insert_runes(buf, 0, s8("hello "));
+	if(!equals(buf, "hello world\n")) {
+		FAIL("insert at the beginning");
+	}
+
+	buffer_insert_runes(buf, buffer_length(buf), s8("foo\nbar"));
+	buffer_insert_runes(buf, 6, s8("big "));
+	if(!equals(buf, "hello big world\nfoo\nbar")) {
+		FAIL("insert in the middle");
+	}
+
+	buffer_insert_runes(buf, buffer_length(buf), s8("baz"));
+	buffer_delete_runes(buf, 0, 6);
+	buffer_delete_runes(buf, 17, 20);
+	if(!equals(buf, "big world\nfoo\nbar")) {
+		FAIL("delete");
+	}
+
+	/* Move the edit position into the middle so the lines straddle it. */
+	buffer_insert_runes(buf, 12, s8("o"));
+	buffer_delete_runes(buf, 12, 13);
+
+	if(buffer_bol(buf, 16) != 14 || buffer_bol(buf, 13) != 10 || buffer_bol(buf, 5) != 0) {
+		FAIL("buffer_bol");
+	}
+
+	if(buffer_eol(buf, 0) != 9 || buffer_eol(buf, 10) != 13 || buffer_eol(buf, 14) != 17) {
+		FAIL("buffer_eol");
+	}
+
+	line_info li = buffer_line_info(buf, 15);
+	if(li.line != 3 || li.col != 2) {
+		FAIL("buffer_line_info");
+	}
+
+	char large[100000];
+	memset(large, 'x', sizeof(large));
+	buffer_insert_runes(buf, 3, (s8) { sizeof(large), large });
+	buffer_delete_runes(buf, 3, 3 + sizeof(large));
+	if(!equals(buf, "big world\nfoo\nbar")) {
+		FAIL("insert and delete large");
+	}
+
+	buffer_delete_runes(buf, 0, buffer_length(buf));
+	if(!random_edits(buf)) {
+		FAIL("random edits");
+	}
+
+	const char *path = "buffer_test.tmp";
+	FILE *file = fopen(path, "wb");
+	fputs("line 1\nline 2\n", file);
+	fclose(file);
+
+	buffer_free(buf);
+	isize read = 0;
+	buf = buffer_open(NULL, path, &read);
+	if(!buf || !equals(buf, "line 1\nline 2\n") || read != 14) {
+		FAIL("buffer_open");
+	}
+
+	buffer_insert_runes(buf, 7, s8("line 1.5\n"));
+	buffer_delete_runes(buf, 0, 2);
+	buffer *snap = buffer_snapshot(buf);
+	if(!buffer_save(buf, path) || !equals(buf, "ne 1\nline 1.5\nline 2\n")) {
+		FAIL("buffer_save");
+	}
+
+	if(buffer_line_count(buf) != 4 || buffer_line_begin(buf, 2) != 14 || buffer_line_at(buf, 13) != 1) {
+		FAIL("lines after buffer_save");
+	}
+
+	buffer_free(buf);
+	if(!snap || !equals(snap, "ne 1\nline 1.5\nline 2\n")) {
+		FAIL("snapshot outliving the buffer");
+	}
+
+	buffer_free(snap);
+	buf = buffer_open(NULL, path, NULL);
+	if(!buf || !equals(buf, "ne 1\nline 1.5\nline 2\n")) {
+		FAIL("buffer_open after buffer_save");
+	}
+
+#ifndef _WIN32
+	// Saving keeps the mode of the file and writes through a symlink to it
+	const char *link = "buffer_test.link";
+	struct stat st;
+	buffer_free(buf);
+	chmod(path, 0751);
+	remove(link);
+
+	if(symlink(path, link) || !(buf = buffer_open(NULL, link, NULL))) {
+		FAIL("symlink");
+	}
+
+	buffer_insert_runes(buf, 0, s8("li"));
+	if(!buffer_save(buf, link) || lstat(link, &st) || !S_ISLNK(st.st_mode) || stat(path, &st) || (st.st_mode & 07777) != 0751) {
+		FAIL("buffer_save through a symlink");
+	}
+
+	buffer_free(buf);
+	buf = buffer_open(NULL, path, NULL);
+	if(!buf || !equals(buf, "line 1\nline 1.5\nline 2\n")) {
+		FAIL("buffer_open after buffer_save through a symlink");
+	}
+
+	// A read-only file is either left alone or stays read-only, as root may write it
+	chmod(path, 0444);
+	buffer_delete_runes(buf, 0, 5);
+	if(buffer_save(buf, path) && (stat(path, &st) || (st.st_mode & 07777) != 0444)) {
+		FAIL("buffer_save of a read-only file");
+	}
+
+	remove(link);
+#endif
+
+	buffer_free(buf);
+	remove(path);
+	return 0;
+}
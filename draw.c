@@ -0,0 +1,250 @@
+#include "draw.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DRAW_X86
+#endif
+
+typedef struct {
+	void (*fill)(unsigned*, isize, unsigned);
+	void (*invert)(unsigned*, isize);
+	void (*blend)(unsigned*, isize, unsigned, unsigned);
+	void (*mask)(unsigned*, const unsigned char*, isize, unsigned, unsigned);
+} kernels;
+
+/* (x + 128 + (x + 128) / 256) / 256 is x / 255 rounded for x up to 255 * 255. */
+static unsigned
+div255(unsigned x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static void
+fill_scalar(unsigned *dst, isize n, unsigned color) {
+	for(isize i = 0; i < n; ++i) {
+		dst[i] = color;
+	}
+}
+
+static void
+invert_scalar(unsigned *dst, isize n) {
+	for(isize i = 0; i < n; ++i) {
+		dst[i] = ~dst[i];
+	}
+}
+
+static void
+blend_scalar(unsigned *dst, isize n, unsigned color, unsigned alpha) {
+	for(isize i = 0; i < n; ++i) {
+		unsigned pixel = 0;
+
+		for(int shift = 0; shift < 32; shift += 8) {
+			unsigned c = color >> shift & 0xFF;
+			unsigned d = dst[i] >> shift & 0xFF;
+			pixel |= div255(c * alpha + d * (255 - alpha)) << shift;
+		}
+
+		dst[i] = pixel;
+	}
+}
+
+static void
+mask_scalar(unsigned *dst, const unsigned char *mask, isize n, unsigned fg, unsigned bg) {
+	for(isize i = 0; i < n; ++i) {
+		unsigned a     = mask[i];
+		unsigned pixel = 0;
+
+		for(int shift = 0; shift < 24; shift += 8) {
+			unsigned f = fg >> shift & 0xFF;
+			unsigned b = bg >> shift & 0xFF;
+			pixel |= div255(f * a + b * (255 - a)) << shift;
+		}
+
+		dst[i] = pixel;
+	}
+}
+
+static const kernels scalar = { fill_scalar, invert_scalar, blend_scalar, mask_scalar };
+
+#ifdef DRAW_X86
+
+__attribute__((target("sse2")))
+static void
+fill_sse2(unsigned *dst, isize n, unsigned color) {
+	__m128i v = _mm_set1_epi32((int)color);
+	isize   i = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+	}
+
+	fill_scalar(dst + i, n - i, color);
+}
+
+__attribute__((target("sse2")))
+static void
+invert_sse2(unsigned *dst, isize n) {
+	__m128i ones = _mm_set1_epi32(-1);
+	isize   i    = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(v, ones));
+	}
+
+	invert_scalar(dst + i, n - i);
+}
+
+/* Blends 4 pixels at a time in 16 bit lanes, 2 pixels to a register. */
+__attribute__((target("sse2")))
+static void
+blend_sse2(unsigned *dst, isize n, unsigned color, unsigned alpha) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i half = _mm_set1_epi16(128);
+	__m128i c    = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero), _mm_set1_epi16((short)alpha));
+	__m128i a    = _mm_set1_epi16((short)(255 - alpha));
+	isize   i    = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		__m128i v  = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), a), c), half);
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), a), c), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	blend_scalar(dst + i, n - i, color, alpha);
+}
+
+__attribute__((target("sse2")))
+static void
+mask_sse2(unsigned *dst, const unsigned char *mask, isize n, unsigned fg, unsigned bg) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i max  = _mm_set1_epi16(255);
+	__m128i half = _mm_set1_epi16(128);
+	__m128i f    = _mm_unpacklo_epi8(_mm_set1_epi32((int)fg), zero);
+	__m128i b    = _mm_unpacklo_epi8(_mm_set1_epi32((int)bg), zero);
+	isize   i    = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		int a;
+		memcpy(&a, mask + i, sizeof(a));
+
+		// Every coverage byte spread over the 4 bytes of its pixel
+		__m128i v = _mm_cvtsi32_si128(a);
+		v = _mm_unpacklo_epi8(v, v);
+		v = _mm_unpacklo_epi16(v, v);
+
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(f, lo), _mm_mullo_epi16(b, _mm_sub_epi16(max, lo))), half);
+		hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(f, hi), _mm_mullo_epi16(b, _mm_sub_epi16(max, hi))), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	mask_scalar(dst + i, mask + i, n - i, fg, bg);
+}
+
+static const kernels sse2 = { fill_sse2, invert_sse2, blend_sse2, mask_sse2 };
+
+__attribute__((target("avx2")))
+static void
+fill_avx2(unsigned *dst, isize n, unsigned color) {
+	__m256i v = _mm256_set1_epi32((int)color);
+	isize   i = 0;
+
+	for(; i + 8 <= n; i += 8) {
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+
+	fill_sse2(dst + i, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static void
+invert_avx2(unsigned *dst, isize n) {
+	__m256i ones = _mm256_set1_epi32(-1);
+	isize   i    = 0;
+
+	for(; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(dst + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(v, ones));
+	}
+
+	invert_sse2(dst + i, n - i);
+}
+
+/* Unpacking and packing work within 128 bit lanes, so the pixels stay in order. */
+__attribute__((target("avx2")))
+static void
+blend_avx2(unsigned *dst, isize n, unsigned color, unsigned alpha) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i half = _mm256_set1_epi16(128);
+	__m256i c    = _mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero), _mm256_set1_epi16((short)alpha));
+	__m256i a    = _mm256_set1_epi16((short)(255 - alpha));
+	isize   i    = 0;
+
+	for(; i + 8 <= n; i += 8) {
+		__m256i v  = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), a), c), half);
+		__m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), a), c), half);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	blend_sse2(dst + i, n - i, color, alpha);
+}
+
+// Glyph rows are a few pixels wide, too short to gain from 8 at a time
+static const kernels avx2 = { fill_avx2, invert_avx2, blend_avx2, mask_sse2 };
+
+#endif // DRAW_X86
+
+/* Threads may race to pick the kernels, but they all pick the same ones. */
+static const kernels*
+cpu(void) {
+	static const kernels *picked;
+	const kernels        *k = __atomic_load_n(&picked, __ATOMIC_RELAXED);
+
+	if(!k) {
+#ifdef DRAW_X86
+		__builtin_cpu_init();
+
+		if(__builtin_cpu_supports("avx2")) {
+			k = &avx2;
+		} else if(__builtin_cpu_supports("sse2")) {
+			k = &sse2;
+		} else
+#endif
+		k = &scalar;
+		__atomic_store_n(&picked, k, __ATOMIC_RELAXED);
+	}
+
+	return k;
+}
+
+void
+draw_fill(unsigned *dst, isize n, unsigned color) {
+	cpu()->fill(dst, n, color);
+}
+
+void
+draw_invert(unsigned *dst, isize n) {
+	cpu()->invert(dst, n);
+}
+
+void
+draw_blend(unsigned *dst, isize n, unsigned color, unsigned alpha) {
+	cpu()->blend(dst, n, color, alpha);
+}
+
+void
+draw_mask(unsigned *dst, const unsigned char *mask, isize n, unsigned fg, unsigned bg) {
+	cpu()->mask(dst, mask, n, fg, bg);
+}
@@ -0,0 +1,21 @@
+#ifndef BED_DRAW_H
+#define BED_DRAW_H
+
+#include "util.h"
+
+/*
+ * Pixel kernels of the software renderer, which work on spans of 0xRRGGBB
+ * pixels. Like the scan kernels, every function picks the widest
+ * implementation the CPU supports the first time it is called.
+ *
+ * draw_fill sets n pixels to a color and draw_invert flips all their bits.
+ * draw_blend mixes a color into n pixels with an alpha from 0 to 255.
+ * draw_mask writes n pixels that go from bg to fg as the n coverage bytes of
+ * a glyph mask go from 0 to 255.
+ */
+void draw_fill(unsigned*, isize, unsigned);
+void draw_invert(unsigned*, isize);
+void draw_blend(unsigned*, isize, unsigned, unsigned);
+void draw_mask(unsigned*, const unsigned char*, isize, unsigned, unsigned);
+
+#endif // BED_DRAW_H
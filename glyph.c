@@ -0,0 +1,115 @@
+#include "glyph.h"
+#include "gui.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SLOTS 256
+
+struct slot {
+	unsigned key;    // rune << 1 | bold, plus one so that 0 is an empty slot
+	int      w;
+	int      h;
+	isize    offset; // Of the mask in masks, or -1 if only the width is known
+};
+
+static struct slot *slot_of(glyph_atlas*, int, bool);
+static struct slot *find(glyph_atlas*, unsigned);
+static void         grow(glyph_atlas*);
+
+glyph
+glyph_get(glyph_atlas *atlas, int rune, bool bold) {
+	struct slot *slot = slot_of(atlas, rune, bold);
+
+	if(slot->offset < 0) {
+		slot->offset = atlas->masks.length;
+
+		isize size = (isize)slot->w * slot->h;
+
+		while(atlas->masks.length + size > atlas->masks.capacity) {
+			slice_grow(&atlas->masks, sizeof(*atlas->masks.data));
+		}
+
+		atlas->masks.length += size;
+		gui_glyph(rune, bold, atlas->masks.data + slot->offset, slot->w, slot->h);
+	}
+
+	return (glyph) { slot->w, slot->h, atlas->masks.data + slot->offset };
+}
+
+int
+glyph_width(glyph_atlas *atlas, int rune, bool bold) {
+	if((unsigned)rune < 128) {
+		int *w = &atlas->ascii[bold][rune];
+
+		if(!*w) {
+			*w = gui_font_width(rune, bold) + 1;
+		}
+
+		return *w - 1;
+	}
+
+	return slot_of(atlas, rune, bold)->w;
+}
+
+void
+glyph_free(glyph_atlas *atlas) {
+	free(atlas->slots);
+	free(atlas->masks.data);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+/*
+ * Returns the slot of a glyph, which knows its size but may not have a mask
+ * yet. Finding a glyph that is there changes nothing.
+ */
+static struct slot*
+slot_of(glyph_atlas *atlas, int rune, bool bold) {
+	unsigned     key  = ((unsigned)rune << 1 | bold) + 1;
+	struct slot *slot = atlas->count ? find(atlas, key) : 0;
+
+	if(slot && slot->key) {
+		return slot;
+	}
+
+	if(2 * (atlas->used + 1) > atlas->count) {
+		grow(atlas);
+	}
+
+	slot         = find(atlas, key);
+	slot->key    = key;
+	slot->w      = gui_font_width(rune, bold);
+	slot->h      = gui_font_height();
+	slot->offset = -1;
+	atlas->used++;
+	return slot;
+}
+
+/* Returns the slot of key, or the empty slot it would go in. */
+static struct slot*
+find(glyph_atlas *atlas, unsigned key) {
+	isize i = (isize)(key * 0x9E3779B1u >> 8) & (atlas->count - 1);
+
+	while(atlas->slots[i].key && atlas->slots[i].key != key) {
+		i = (i + 1) & (atlas->count - 1);
+	}
+
+	return atlas->slots + i;
+}
+
+/* Doubles the slots, which keeps the masks where they are. */
+static void
+grow(glyph_atlas *atlas) {
+	glyph_atlas old = *atlas;
+	atlas->count = old.count ? 2 * old.count : MIN_SLOTS;
+	atlas->slots = calloc((size_t)atlas->count, sizeof(struct slot));
+	assert(atlas->slots);
+
+	for(isize i = 0; i < old.count; ++i) {
+		if(old.slots[i].key) {
+			*find(atlas, old.slots[i].key) = old.slots[i];
+		}
+	}
+
+	free(old.slots);
+}
@@ -0,0 +1,43 @@
+#ifndef BED_GLYPH_H
+#define BED_GLYPH_H
+
+#include "util.h"
+
+#include <stdbool.h>
+
+/*
+ * An atlas of the coverage masks of glyphs, keyed by rune and weight. A glyph
+ * is rasterized by gui_glyph the first time it is asked for, and after that it
+ * comes from the atlas. The mask has a byte for every pixel, row by row, and
+ * stays valid until glyph_get rasterizes another glyph.
+ *
+ * Threads may call glyph_get at the same time for glyphs that are already
+ * rasterized, since that only reads the atlas.
+ *
+ * glyph_width asks gui_font_width once for every rune and weight, and then
+ * only looks the width up: in a table for ASCII, and in the atlas for the
+ * rest, without rasterizing the glyph.
+ */
+typedef struct {
+	int                  w;
+	int                  h;
+	const unsigned char *mask;
+} glyph;
+
+typedef struct {
+	struct slot         *slots;        // Open addressing, a power of two of them
+	isize                count;
+	isize                used;
+	struct {
+		unsigned char *data;
+		isize          length;
+		isize          capacity;
+	} masks;                           // Every mask, one after the other
+	int                  ascii[2][128]; // Widths of ASCII runes plus one, 0 if unknown
+} glyph_atlas;
+
+glyph glyph_get(glyph_atlas*, int, bool);
+int   glyph_width(glyph_atlas*, int, bool);
+void  glyph_free(glyph_atlas*);
+
+#endif // BED_GLYPH_H
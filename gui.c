@@ -1,6 +1,11 @@
+#include "draw.h"
+#include "glyph.h"
 #include "gui.h"
+#include "load.h"
 #include "log.h"
+#include "scan.h"
 #include "syntax.h"
+#include "thread.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -15,9 +20,10 @@
  */
 static isize cursor_pos;
 static int   cursor_x;     // Target x of the cursor when moving between lines
-static int   cursor_state; // Implements blinking of the cursor
+static isize cursor_moved; // gui_time of the last move, the blinking starts from it
 
 static isize set_cursor_pos(isize);
+static bool  cursor_visible(isize);
 
 /* CURSOR API END */
 
@@ -40,24 +46,277 @@ static void  erase_selection(void);
 /* DISPLAY API BEGIN */
 
 typedef struct {
-	int x;
-	int y;
-	int w;
+	int   x;
+	int   y;
+	int   w;
+	bool  trailing; // Blank at the end of a line
+	isize pos;      // Buffer position of the rune
 } cell;
 
+typedef struct {
+	isize    first; // Index in display of the first rune of the row
+	isize    run;   // Index in display_runs of the first run of the row
+	uint64_t hash;  // Of what the row shows, to tell whether it changed
+} row;
+
+/* Runes next to each other on a row that are drawn in one go. */
+typedef struct {
+	isize first;    // Index in display of the first rune of the run
+	isize last;     // Index in display after the last rune of the run
+	int   event;    // Highlight of the runes, or -1
+	bool  trailing; // Trailing blanks, which are drawn as one rect
+} run;
+
 static struct {
 	cell  *data;
 	isize  length;
 	isize  capacity;
-} display;                // Slice of x,y coords of every rune in the display
-static isize display_pos; // Buffer position of the first rune visible in the display
+} display,                // Slice of x,y coords of every rune in the display, in buffer order
+  display_moved;          // The cells of the display before it last moved
+static isize display_pos; // Buffer position the display is laid out from
+static struct {
+	row   *data;
+	isize  length;
+	isize  capacity;
+} display_rows;           // Every row of text on the screen, empty ones included
+static struct {
+	run   *data;
+	isize  length;
+	isize  capacity;
+} display_runs;           // Every run of runes that share a row and a style
 
 static cell  xy_at_buffer_pos(isize);
 static isize buffer_pos_at_xy(int, int);
+static isize display_index(isize);
+static bool  display_shows(isize);
 static void  display_scroll(int);
+static void  display_move(isize);
+static void  display_jump(isize);
+static void  display_jump_row(isize);
+static void  display_layout(isize, isize, int*, int*);
+static cell  display_rune(isize, int, bool, int, int, int*, int*);
+static void  display_trail(isize);
+static void  display_long(isize, isize, int);
+static void  display_index_rows(void);
 
 /* DISPLAY API END */
 
+/* LAYOUT API BEGIN */
+
+/*
+ * The cells of recently laid out lines, so that a reflow only lays out the
+ * lines an edit touched. A line is laid out again when the display gets wider
+ * or narrower, or when its bold runes change, since those can be wider. The y
+ * of a cell counts rows from the top of its line. Only whole lines, newline
+ * included, are kept.
+ */
+#define LAYOUT_LINES 256  // Lines kept, the least recently used one goes first
+#define LAYOUT_MAX   4096 // Runes in the longest line kept
+
+typedef struct {
+	isize begin;    // Buffer position of the line
+	isize length;   // Runes in the line, 0 if the entry is unused
+	int   width;    // Of the display the line was laid out for
+	isize used;     // layout_clock when the line was last laid out or reused
+	struct {
+		cell  *data;
+		isize  length;
+		isize  capacity;
+	} cells;
+	struct {
+		isize *data;
+		isize  length;
+		isize  capacity;
+	} bold;         // Begin and end of every bold highlight, from begin
+} layout;
+
+static layout layouts[LAYOUT_LINES];
+static isize  layout_clock;
+
+static layout *layout_line(isize, isize);
+static void    layout_edit(isize, isize, isize);
+
+/* LAYOUT API END */
+
+/* WRAP API BEGIN */
+
+/*
+ * The rows every line wraps to at the width of the display, in a Fenwick
+ * tree, so that both the first row of a line and the line of a row take
+ * O(log n). Counting every line would lay out the whole buffer, so a line
+ * counts as one row until it is laid out for a jump. The tree only holds the
+ * rows past the first, which are 0 for most lines, so an edit moves the
+ * counted lines after it and adds or drops the entries of the lines it adds
+ * or removes. The index starts over when the width changes.
+ */
+typedef struct {
+	isize line;
+	int   rows;
+} wrapped;
+
+static struct {
+	int   width; // Of the display the rows were counted for
+	struct {
+		isize *data;
+		isize  length;
+		isize  capacity;
+	} tree;      // Fenwick tree of the rows past the first, from 1
+	struct {
+		wrapped *data;
+		isize    length;
+		isize    capacity;
+	} lines;     // Counted lines of more than one row, in order
+} wrap;
+
+static void  wrap_index(void);
+static int   wrap_count(isize);
+static void  wrap_edit(isize, isize, isize);
+static isize wrap_row(isize);
+static isize wrap_line_at_row(isize);
+static int   wrap_layout(isize, isize, isize, isize*);
+
+/* WRAP API END */
+
+/* LONG LINE API BEGIN */
+
+/*
+ * Lines longer than LONG_LINE are not wrapped but scrolled sideways, so a
+ * line of many MB takes one row and only the runes in view are laid out. All
+ * long lines on the display are scrolled by scroll_x, which follows the
+ * cursor. They are not highlighted.
+ *
+ * The x of every LONG_STEP-th rune of a long line is kept, counted from the
+ * start of the line, so that finding the x of a rune or the rune at an x only
+ * lays out the runes since a checkpoint. Checkpoints are made as far into
+ * the line as they were needed, and an edit drops the ones after it.
+ */
+#define LONG_LINE  (1 << 14) // Runes in the shortest line that is scrolled sideways
+#define LONG_STEP  1024      // Runes between checkpoints
+#define LONG_LINES 16        // Lines with checkpoints, the least recently used one goes first
+
+typedef struct {
+	isize begin; // Buffer position of the line
+	isize used;  // layout_clock when the line was last used
+	struct {
+		isize *data;
+		isize  length;
+		isize  capacity;
+	} x;         // x of begin + k * LONG_STEP, 0 if the entry is unused
+} long_line;
+
+static long_line long_lines[LONG_LINES];
+static isize     scroll_x; // Pixels long lines are scrolled to the left
+
+static bool       long_is(isize, isize);
+static isize      long_next(isize, isize);
+static isize      long_x(isize, isize);
+static isize      long_pos(isize, isize, isize, isize*);
+static void       long_edit(isize, isize, isize);
+static void       long_follow(void);
+static int        long_width(int);
+static long_line *long_checkpoints(isize);
+
+/* LONG LINE API END */
+
+/* DAMAGE API BEGIN */
+
+/*
+ * What was drawn in the last frame. A row is drawn again when its hash
+ * changes, which edits, scrolling and new highlights do, or when the cursor
+ * or the selection moves in or out of it. Only the rows drawn again are
+ * passed to gui_invalidate.
+ */
+static struct {
+	dimensions dim;          // Everything is drawn again when it changes
+	struct {
+		uint64_t *data;
+		isize     length;
+		isize     capacity;
+	} rows;                  // Hash of every row
+	cell       cursor;       // y is -1 if the cursor was not drawn
+	isize      selected[2];  // Selected runes on the display, or -1
+	int        selection[2]; // y of the first and last selected rows, or -1
+	uint64_t   tag;          // Hash of the tag line
+} drawn = { .cursor.y = -1, .selected = { -1, -1 }, .selection = { -1, -1 } };
+
+/*
+ * Pixels the rows moved down since the last frame. The next frame moves the
+ * pixels and the hashes of the rows drawn by as much, so only the rows that
+ * scrolled into view are drawn again.
+ */
+static int scrolled;
+
+#define FNV_OFFSET 0xcbf29ce484222325
+
+static void     damage_scroll(int);
+static void     damage_rows(bool*, int, int);
+static uint64_t hash(uint64_t, const void*, isize);
+
+/* DAMAGE API END */
+
+/* FRAME API BEGIN */
+
+/*
+ * Frames are drawn when something asks for one, not at a fixed rate.
+ * gui_next_frame tells the platform how long it may sleep before it has to
+ * call gui_redraw: not at all after input or a reflow, until the cursor
+ * blinks next, a little while background work is running, and otherwise
+ * until the next event. The cursor stops blinking BLINK_STOP ms after it last
+ * moved, so an idle editor does not wake up at all.
+ */
+#define BLINK_PERIOD 250   // ms the cursor is shown, and then hidden
+#define BLINK_STOP   10000 // ms, an even number of periods so it stays shown
+#define BUSY_POLL    16    // ms between looks at loading and parsing
+
+static bool  frame_wanted = true; // Something changed that is not drawn yet
+static bool  frame_active;        // gui_is_active when the last frame was drawn
+static isize frame_time;          // gui_time when the last frame was drawn
+
+/* FRAME API END */
+
+/* RENDER API BEGIN */
+
+/*
+ * The dirty rows of a frame are drawn by worker threads and gui_redraw
+ * together, each taking the next row until none are left. What the rows need
+ * from the buffer and the platform is looked up first, on the UI thread: the
+ * runes of every run, whose glyphs go in the atlas then, and the dimensions.
+ * The workers read only that, display and display_runs, and each writes the
+ * pixels of its own rows. gui_text is called from the workers too. They are
+ * started on the first frame with RENDER_ROWS dirty rows and run until
+ * gui_close.
+ */
+#define RENDER_THREADS 32 // Most threads drawing a frame, gui_redraw's included
+#define RENDER_ROWS    8  // Fewest dirty rows worth waking the workers for
+
+static struct {
+	dimensions dim;         // Of the frame, which the drawing functions use
+	int        line_height;
+	color      bg;
+	color      margin;
+	isize      tinted[2];   // Selected runes on the display
+	isize     *rows;        // The dirty rows
+	isize      count;
+	isize      next;        // Index in rows of the next row to draw, taken atomically
+	s8        *texts;       // Runes of every run of the dirty rows, tabs expanded
+	int       *eols;        // Last rune of every dirty row, or -1
+	arena      scratch[RENDER_THREADS];
+	thread     workers[RENDER_THREADS];
+	int        threads;     // Workers started, -1 if none could be
+	mutex      lock;        // Guards the fields below
+	condvar    wake;        // Workers wait on it for the next frame
+	condvar    done;        // gui_redraw waits on it for the workers
+	isize      frame;       // Frames handed to the workers
+	int        busy;        // Workers still drawing the frame
+	bool       quit;        // Set by gui_close to stop the workers
+} render;
+
+static void render_frame(arena);
+static void render_rows(arena);
+static void render_worker(void*);
+
+/* RENDER API END */
+
 /* GUI IMPLEMENTATION BEGIN */
 
 #define MARGIN_TOP   0
@@ -65,10 +324,33 @@ static void  display_scroll(int);
 #define MARGIN_L     0
 #define MARGIN_R     5
 
+#ifndef HIGHLIGHTS_PATH
+#define HIGHLIGHTS_PATH "highlights.scm"
+#endif
+
+// Bytes read before the first frame, the rest of the file loads meanwhile
+#define PREVIEW_SIZE (64 << 10)
+
+// Bytes a backward scan looks at before it steps back again
+#define SCAN_BLOCK (4 << 10)
+
+static const struct {
+	color color;
+	bool  bold;
+} styles[syntax_end] = {
+	[syntax_comment] = { rgb(128, 128, 128) },
+	[syntax_string]  = { rgb(244, 187, 68) },
+	[syntax_keyword] = { 0, true },
+	[syntax_number]  = { rgb(0, 128, 128) },
+	[syntax_type]    = { rgb(0, 96, 160) },
+	[syntax_preproc] = { rgb(160, 64, 160) },
+};
+
 unsigned          *pixels;
 static buffer     *buf;
 static const char *buf_file_path;
 static syntax_t   *syntax;
+static glyph_atlas glyphs;
 static log_t       undo;
 static log_t       redo;
 static b32         warn_unsaved_changes;
@@ -76,57 +358,66 @@ static struct {
 	highlight_t *data;
 	isize        length;
 	isize        capacity;
-} highlights;
+} highlights,
+  highlights_moved; // The highlights of display_moved
+
+typedef struct {
+	isize begin;
+	isize end;   // End of the deleted runes, or begin for an insertion
+	s8    runes; // Inserted runes
+} preview_edit;
+
+static struct {
+	load_t *load;   // Set while the rest of the file loads
+	b32     failed; // The rest could not be loaded, so saving would lose it
+	struct {
+		preview_edit *data;
+		isize         length;
+		isize         capacity;
+	} edits;        // Edits to the preview, made again on the loaded buffer
+} loading;
 
 static void draw_rect(int, int, int, int, color);
+static void draw_tint(int, int, int, int, color, unsigned);
 static void draw_cursor(int, int, int);
+static void draw_row(arena, isize);
+static s8   run_text(arena*, run*);
+static void draw_text(arena, int, int, s8, color, color, bool);
 static void insert_rune(isize, int);
 static void insert_runes(isize, s8);
 static void insert_runes2(isize, s8, bool);
 static void delete_rune(isize);
 static void delete_runes(isize, isize);
 static void delete_runes2(isize, isize, bool);
+static void edit_begin(void);
+static void edit_end(void);
 static b32  buffer_is_dirty(buffer*);
+static void finish_loading(void);
+static isize scan_runes(isize (*)(const char*, isize), isize, isize);
+static isize scan_runes_back(isize (*)(const char*, isize), isize, isize);
 
 b32
 gui_file_open(arena *memory, const char *file_path) {
-	FILE *file = fopen(file_path, "rb");
+	b32 complete;
 
-	if(!file) {
+	if(!(buf = load_preview(file_path, PREVIEW_SIZE, &complete))) {
 		// TODO: handle error
 		goto FAIL;
 	}
 
-	if(!(buf = buffer_new(memory))) {
+	if(!(syntax = syntax_new(HIGHLIGHTS_PATH))) {
 		goto FAIL;
 	}
 
-	if(!(syntax = syntax_new())) {
+	if(!complete && !(loading.load = load_begin(file_path))) {
 		goto FAIL;
 	}
 
-	arena tmp = *memory;
-	s8 iobuf = { .length = 8 * 1024 };
-	iobuf.data = arena_alloc(&tmp, 1, 1, iobuf.length, 0);
-
-	while(!feof(file)) {
-		iobuf.length = (isize)fread(iobuf.data, 1, (size_t)iobuf.length, file);
-
-		if(ferror(file)) {
-			// TODO: handle error
-			goto FAIL;
-		}
-
-		buffer_insert_runes(buf, buffer_length(buf), iobuf);
-	}
-
 	buf_file_path = strdup(file_path);
 	syntax_insert(syntax, buf, 0, buffer_length(buf));
-	fclose(file);
 	return 1;
 
 FAIL:
-	if(file)   fclose(file);
 	if(syntax) syntax_free(syntax);
 	if(buf)    buffer_free(buf);
 	return 0;
@@ -139,17 +430,87 @@ gui_redraw(arena memory) {
 	color      bg_color    = rgb(255, 255, 234);
 	int        line_height = gui_font_height();
 
-	{ // Draw background
+	render.dim         = dim;
+	render.line_height = line_height;
+	render.bg          = bg_color;
+	render.margin      = magenta;
+
+	if(loading.load && load_done(loading.load)) {
+		finish_loading();
+	}
+
+	if(syntax_poll(syntax, buf)) {
+		gui_reflow();
+	}
+
+	isize rows  = display_rows.length;
+	bool *dirty = arena_alloc(&memory, sizeof(bool), alignof(bool), rows + 1, 0);
+	bool  all   = dim.w != drawn.dim.w || dim.h != drawn.dim.h;
+
+	// Selected runes on the display, which are tinted after the text is drawn
+	isize tinted[2] = { 0, 0 };
+
+	if(scrolled && !all) {
+		damage_scroll(scrolled);
+	}
+
+	scrolled = 0;
+
+	{ // Find the rows that changed since they were drawn
+		for(isize r = 0; r < rows; ++r) {
+			dirty[r] = all || r >= drawn.rows.length || drawn.rows.data[r] != display_rows.data[r].hash;
+		}
+
+		cell cursor = { .y = -1 };
+
+		if(cursor_visible(gui_time())) {
+			if(display_shows(cursor_pos)) {
+				cursor = xy_at_buffer_pos(cursor_pos);
+			}
+		}
+
+		if(cursor.x != drawn.cursor.x || cursor.y != drawn.cursor.y) {
+			damage_rows(dirty, drawn.cursor.y, drawn.cursor.y);
+			damage_rows(dirty, cursor.y, cursor.y);
+			drawn.cursor = cursor;
+		}
+
+		isize selected[2] = { -1, -1 };
+		int   first_row   = -1;
+		int   last_row    = -1;
+
+		if(selection_valid) {
+			tinted[0] = display_index(selection_begin());
+			tinted[1] = display_index(selection_end() + 1);
+		}
+
+		if(tinted[0] < tinted[1]) {
+			selected[0] = display.data[tinted[0]].pos;
+			selected[1] = display.data[tinted[1] - 1].pos;
+			first_row   = display.data[tinted[0]].y;
+			last_row    = display.data[tinted[1] - 1].y;
+		}
+
+		if(selected[0] != drawn.selected[0] || selected[1] != drawn.selected[1] || first_row != drawn.selection[0] || last_row != drawn.selection[1]) {
+			damage_rows(dirty, drawn.selection[0], drawn.selection[1]);
+			damage_rows(dirty, first_row, last_row);
+			drawn.selected[0]  = selected[0];
+			drawn.selected[1]  = selected[1];
+			drawn.selection[0] = first_row;
+			drawn.selection[1] = last_row;
+		}
+	}
+
+	if(all) { // Draw background
 		draw_rect(0, 0, dim.w, dim.h, bg_color);
 		draw_rect(0, 0, dim.w, MARGIN_TOP, magenta);
 		draw_rect(0, 0, MARGIN_L, dim.h, magenta);
 		draw_rect(dim.w - MARGIN_R, 0, MARGIN_R, dim.h, magenta);
-		gui_set_bg_color(bg_color);
+		gui_invalidate(0, 0, dim.w, dim.h);
 	}
 
 	{ // Draw buffer tag line
 		color tag_color = warn_unsaved_changes ? rgb(255, 0, 0) : rgb(231, 255, 221);
-		draw_rect(0, dim.h - MARGIN_BOT, dim.w, MARGIN_BOT, tag_color);
 
 		s8 buffer_label;
 		buffer_label.data   = arena_alloc(&memory, 1, 1, 512, ALLOC_NOZERO);
@@ -164,156 +525,177 @@ gui_redraw(arena memory) {
 			s8_append(&buffer_label, '*');
 		}
 
+		if(loading.load) {
+			double read = (double)load_progress(loading.load) / (1 << 20);
+			double size = (double)load_size(loading.load) / (1 << 20);
+			char  *end  = buffer_label.data + buffer_label.length;
+			size_t left = (size_t)(512 - buffer_label.length);
+
+			if(size >= 0) {
+				buffer_label.length += snprintf(end, left, " (loading, %.1f of %.1f MB)", read, size);
+			} else {
+				buffer_label.length += snprintf(end, left, " (loading, %.1f MB read)", read);
+			}
+		} else if(loading.failed) {
+			s8 status = s8(" (not fully loaded, cannot save)");
+			memcpy(buffer_label.data + buffer_label.length, status.data, (size_t)status.length);
+			buffer_label.length += status.length;
+		}
+
 		line_info li = buffer_line_info(buf, cursor_pos);
 		s8 line_label;
 		line_label.data   = arena_alloc(&memory, 1, 1, 512, ALLOC_NOZERO);
 		line_label.length = sprintf(line_label.data, "%d,%d", li.line, li.col);
 
-		gui_set_bg_color(tag_color);
-		gui_set_text_color(warn_unsaved_changes ? rgb(255, 255, 255) : rgb(0, 0, 0));
-		gui_text(MARGIN_L, dim.h - gui_font_height(), buffer_label);
-		gui_text(dim.w - MARGIN_R - 75, dim.h - gui_font_height(), line_label);
-		gui_set_text_color(rgb(0, 0, 0));
-		gui_set_bg_color(bg_color);
-	}
-
-	{ // Draw runes
-		static const color syntax_colors[syntax_end] = {
-			[syntax_comment] = rgb(128, 128, 128),
-			[syntax_string]  = rgb(244, 187, 68),
-		};
-		highlight_t *highlight = highlights.data;
-
-		for(isize i = display_pos; i < display_pos + display.length; ++i) {
-			if(highlight < highlights.data + highlights.length) {
-				if(highlight->end == i) {
-					gui_set_text_bold(false);
-					gui_set_text_color(0);
-					highlight++;
-				}
-
-				if(highlight->begin == i) {
-					if(highlight->event == syntax_keyword) {
-						gui_set_text_bold(true);
-					} else {
-						gui_set_text_color(syntax_colors[highlight->event]);
-					}
-				}
+		// What the parse trees and the highlights of the file cost
+		syntax_memory_t used = syntax_memory();
+		s8 memory_label;
+		memory_label.data   = arena_alloc(&memory, 1, 1, 64, ALLOC_NOZERO);
+		memory_label.length = sprintf(memory_label.data, "trees %.1f MB, highlights %.1f MB", (double)used.trees / (1 << 20), (double)used.highlights / (1 << 20));
+
+		uint64_t tag = hash(FNV_OFFSET, &tag_color, sizeof(tag_color));
+		tag = hash(tag, buffer_label.data, buffer_label.length);
+		tag = hash(tag, line_label.data, line_label.length);
+		tag = hash(tag, memory_label.data, memory_label.length);
+
+		if(all || tag != drawn.tag) {
+			color text_color = warn_unsaved_changes ? rgb(255, 255, 255) : rgb(0, 0, 0);
+			draw_rect(0, dim.h - MARGIN_BOT, dim.w, MARGIN_BOT, tag_color);
+			draw_text(memory, MARGIN_L, dim.h - gui_font_height(), buffer_label, text_color, tag_color, false);
+
+			// The memory label goes left of the line label, and only if it clears the path
+			int space    = glyph_width(&glyphs, ' ', false);
+			int memory_x = dim.w - MARGIN_R - 75 - (int)(memory_label.length + 2) * space;
+			if(memory_x >= MARGIN_L + (int)(buffer_label.length + 2) * space) {
+				draw_text(memory, memory_x, dim.h - gui_font_height(), memory_label, text_color, tag_color, false);
 			}
+			draw_text(memory, dim.w - MARGIN_R - 75, dim.h - gui_font_height(), line_label, text_color, tag_color, false);
+			gui_invalidate(0, dim.h - MARGIN_BOT, dim.w, MARGIN_BOT);
+			drawn.tag = tag;
 
-			if(selection_valid) {
-				gui_set_bg_color(selection_begin() <= i && i <= selection_end() ? rgb(208, 235, 255) : bg_color);
-			}
+			// Rows drawn over the tag line go over it again
+			damage_rows(dirty, dim.h - MARGIN_BOT, dim.h - 1);
+		}
+	}
+
+	{ // Draw dirty rows
+		isize band = -1; // First row of the dirty rows being drawn
+
+		render.rows      = arena_alloc(&memory, sizeof(isize), alignof(isize), rows + 1, ALLOC_NOZERO);
+		render.eols      = arena_alloc(&memory, sizeof(int), alignof(int), rows + 1, ALLOC_NOZERO);
+		render.texts     = arena_alloc(&memory, sizeof(s8), alignof(s8), display_runs.length + 1, ALLOC_NOZERO);
+		render.count     = 0;
+		render.tinted[0] = tinted[0];
+		render.tinted[1] = tinted[1];
 
-			int rune = buffer_get(buf, i);
-			cell xy  = xy_at_buffer_pos(i);
+		for(isize r = 0; r <= rows; ++r) {
+			if(r == rows || !dirty[r]) {
+				if(band >= 0 && !all) {
+					gui_invalidate(0, MARGIN_TOP + (int)band * line_height, dim.w, (int)(r - band) * line_height);
+				}
 
-			draw_rect(dim.w - MARGIN_R, xy.y, MARGIN_R, line_height, rgb(0, 255, 0));
+				band = -1;
+				continue;
+			}
 
-			if(rune == -1 || rune == '\n') {
-				draw_rect(dim.w - MARGIN_R, xy.y, MARGIN_R, line_height, magenta);
+			band = band < 0 ? r : band;
+			render.rows[render.count++] = r;
 
-				for(isize j = i-1; j >= display_pos; --j) {
-					rune = buffer_get(buf, j);
+			isize first    = display_rows.data[r].first;
+			isize last     = r + 1 < rows ? display_rows.data[r + 1].first : display.length;
+			isize runs_end = r + 1 < rows ? display_rows.data[r + 1].run : display_runs.length;
+			render.eols[r] = last > first ? buffer_get(buf, display.data[last - 1].pos) : -1;
 
-					if(rune == '\t' || rune == ' ' || rune == '\r') {
-						xy = xy_at_buffer_pos(j);
-						draw_rect(xy.x, xy.y, xy.w, line_height, rgb(255, 0, 0));
-					} else {
-						break;
-					}
+			for(isize k = display_rows.data[r].run; k < runs_end; ++k) {
+				if(!display_runs.data[k].trailing) {
+					render.texts[k] = run_text(&memory, display_runs.data + k);
 				}
-			} else {
-				gui_text(xy.x, xy.y, rune == '\t' ? s8("    ") : (s8) { 1, (char*)&rune });
 			}
 		}
+
+		render_frame(memory);
 	}
 
-	{ // Draw cursor
-		if(gui_is_active()) {
-			cursor_state = (cursor_state + 1) % 60;
-		}
+	drawn.dim = dim;
+	drawn.rows.length = 0;
+	frame_wanted = false;
+	frame_active = gui_is_active();
+	frame_time   = gui_time();
 
-		if(cursor_state < 15 || (cursor_state >= 30 && cursor_state < 45)) {
-			if(display_pos <= cursor_pos && cursor_pos < display_pos + display.length) {
-				cell cursor_xy = xy_at_buffer_pos(cursor_pos);
-				draw_cursor(cursor_xy.x, cursor_xy.y, cursor_xy.w);
-			}
-		}
+	for(isize r = 0; r < rows; ++r) {
+		*push(&drawn.rows) = display_rows.data[r].hash;
 	}
 }
 
 /* Must be called whenever buffer contents change or the dimensions change. */
 void
 gui_reflow(void) {
-	dimensions dim = gui_dimensions();
 	int x = MARGIN_L;
 	int y = MARGIN_TOP;
-	int display_bot = dim.h - MARGIN_BOT - gui_font_height();
-	cell *c;
-	highlight_t highlight;
 
 	highlights.length = 0;
 	display.length = 0;
+	display_layout(display_pos, buffer_length(buf) + 1, &x, &y);
+	display_index_rows();
+	frame_wanted = true;
+}
 
-	syntax_highlight_begin(syntax);
+/* Returns the ms until gui_redraw has to be called, or -1 to wait for an event. */
+int
+gui_next_frame(void) {
+	if(frame_wanted || frame_active != gui_is_active()) {
+		return 0;
+	}
 
-	for(isize i = display_pos; y < display_bot; ++i) {
-		int rune = buffer_get(buf, i);
+	// Deadlines count from the last frame, so one that has passed asks for a frame now
+	isize elapsed = frame_time - cursor_moved;
+	isize due     = -1;
 
-		if(rune == -1) {
-			c = push(&display);
-			c->x = x;
-			c->y = y;
-			c->w = 8;
-			break;
-		}
+	if(frame_active && elapsed < BLINK_STOP) {
+		due = frame_time + BLINK_PERIOD - elapsed % BLINK_PERIOD;
+	}
 
-		if(highlights.length && highlights.data[highlights.length - 1].end == i) {
-			gui_set_text_bold(false);
-		}
+	if((loading.load || syntax_busy(syntax)) && (due < 0 || due > frame_time + BUSY_POLL)) {
+		due = frame_time + BUSY_POLL;
+	}
 
-		if(!highlights.length || highlights.data[highlights.length - 1].end <= i) {
-			if(syntax_highlight_next(syntax, buf, i, &highlight)) {
-				if(highlight.event == syntax_keyword) {
-					gui_set_text_bold(true);
-				}
+	if(due < 0) {
+		return -1;
+	}
 
-				*push(&highlights) = highlight;
-			}
-		}
+	isize wait = due - gui_time();
+	return wait > 0 ? (int)wait : 0;
+}
 
-		int width = rune == '\t' ? 4 * gui_font_width(' ') : gui_font_width(rune);
+/* Moves the cursor to the start of line, counting from 1, and shows that line on the first row. */
+void
+gui_jump_line(isize line) {
+	isize lines = buffer_line_count(buf);
+	line = line < 1 ? 0 : line > lines ? lines - 1 : line - 1;
+
+	frame_wanted = true;
+	set_cursor_pos(buffer_line_begin(buf, line));
+	wrap_index();
+	display_jump_row(wrap_row(line));
+}
 
-		if(rune == '\n') {
-			c = push(&display);
-			c->x = x;
-			c->y = y;
-			c->w = width;
-			x = MARGIN_L;
-			y += gui_font_height();
-		} else if(x + width > dim.w - MARGIN_R) {
-			x = MARGIN_L;
-			y += gui_font_height();
-			c = push(&display);
-			c->x = x;
-			c->y = y;
-			c->w = width;
-			x += width;
-		} else {
-			c = push(&display);
-			c->x = x;
-			c->y = y;
-			c->w = width;
-			x += width;
-		}
-	}
+/* Scrolls to percent of the way through the rows of the buffer, as far as the wrap index has counted them. */
+void
+gui_jump_percent(int percent) {
+	percent = percent < 0 ? 0 : percent > 100 ? 100 : percent;
 
-	syntax_highlight_end(syntax);
+	frame_wanted = true;
+	wrap_index();
+
+	isize rows = wrap_row(buffer_line_count(buf));
+	isize row  = rows * percent / 100;
+	display_jump_row(row < rows ? row : rows - 1);
 }
 
 void
 gui_mouse(gui_event event, int mouse_x, int mouse_y) {
+	frame_wanted = true;
+
 	switch(event) {
 		case mouse_scrolldown:
 			display_scroll(4);
@@ -347,15 +729,17 @@ gui_mouse(gui_event event, int mouse_x, int mouse_y) {
 
 void
 gui_keyboard(arena memory, gui_event event, int modifiers) {
+	frame_wanted = true;
+
 	{ // Make sure cursor is visible
 		if(cursor_pos < display_pos) {
 			display_pos = buffer_bol(buf, cursor_pos);
 			gui_reflow();
-		} else {
-			while(display_pos + display.length <= cursor_pos) {
-				display_scroll(1); // TODO: this is very inefficient when the cursor is far away
-			}
+		} else if(!display.length || display.data[display.length - 1].pos < cursor_pos) {
+			display_jump(cursor_pos);
 		}
+
+		long_follow();
 	}
 
 	if(event == kbd_left) {
@@ -406,44 +790,32 @@ gui_keyboard(arena memory, gui_event event, int modifiers) {
 				delete_runes(buffer_bol(buf, cursor_pos), cursor_pos);
 			}
 		} else if(ch == ctrl_s) {
-			FILE *file = fopen(buf_file_path, "wb");
+			if(loading.load) {
+				finish_loading();
+			}
 
-			if(!file) {
+			if(loading.failed || !buffer_save(buf, buf_file_path)) {
 				// TODO: handle error
 				return;
 			}
 
-			for(uint32_t i = 0;;) {
-				const char *runes = buffer_read(buf, i, &i);
-
-				if(!i) {
-					break;
-				}
-
-				if(fwrite(runes, 1, i, file) < i) {
-					// TODO: handle error
-					fclose(file);
-					return;
-				}
-			}
-
 			warn_unsaved_changes = 0;
 			log_clear(&undo);
 			log_clear(&redo);
-			fclose(file);
 		} else if(ch == ctrl_z || ch == ctrl_y) {
 			log_t       *push = ch == ctrl_z ? &redo : &undo;
 			log_t       *pop  = ch == ctrl_z ? &undo : &redo;
 			log_entry_t *top = log_top(pop);
 
-			if(top) {
+			syntax_begin(syntax);
+			log_begin(push);
+
+			// Undo the entries of a group down to its first one
+			for(b32 joined = 1; joined && top; top = log_top(pop)) {
 				switch(top->type) {
 					case entry_insert:
-						s8 erased = {0};
-						erased.data = malloc((size_t)top->length);
-						for(int i = 0; i < top->length; ++i) {
-							s8_append(&erased, buffer_get(buf, top->at + i));
-						}
+						s8 erased = { top->length, malloc((size_t)top->length) };
+						buffer_copy(buf, top->at, top->at + top->length, erased.data);
 						log_push_erase(push, top->at, erased);
 						delete_runes2(top->at, top->at + top->length, false);
 						break;
@@ -454,9 +826,13 @@ gui_keyboard(arena memory, gui_event event, int modifiers) {
 						break;
 				}
 
+				joined = top->joined;
 				log_pop(pop);
 			}
 
+			log_end(push);
+			syntax_commit(syntax, buf);
+
 			if(!buffer_is_dirty(buf)) {
 				warn_unsaved_changes = 0;
 			}
@@ -470,88 +846,78 @@ gui_keyboard(arena memory, gui_event event, int modifiers) {
 			}
 		} else if(ch == ctrl_v) {
 			s8 clipboard = gui_clipboard_get();
+			edit_begin();
 			erase_selection();
 			insert_runes(cursor_pos, clipboard);
+			edit_end();
 		} else if(ch == ctrl_w) {
-			isize whitespace = cursor_pos;
-
-			for(isize bol = buffer_bol(buf, cursor_pos); whitespace > bol; --whitespace) {
-				int rune = buffer_get(buf, whitespace);
-
-				if(rune == ' ' || rune == '\t') {
-					break;
+			isize bol = buffer_bol(buf, cursor_pos);
+			isize end = cursor_pos < buffer_length(buf) ? cursor_pos + 1 : cursor_pos;
+			isize whitespace = scan_runes_back(scan_blank_back, bol + 1, end);
+			delete_runes(whitespace < 0 ? bol : whitespace, cursor_pos);
+		} else if(ch == tab && selection_valid) {
+			// Rewrite the selected lines at once, so indenting is a single edit
+			b32   newline  = 1;
+			isize begin    = selection_begin();
+			isize last     = selection_end();
+			isize end      = last < buffer_length(buf) ? last + 1 : buffer_length(buf);
+			s8    lines    = { end - begin, malloc((size_t)(end - begin)) };
+			s8    indented = { 0, malloc((size_t)(2 * (end - begin))) };
+			buffer_copy(buf, begin, end, lines.data);
+
+			for(isize i = 0; i < lines.length; ++i) {
+				char rune = lines.data[i];
+
+				if(newline && rune != '\n' && !(modifiers & 1)) {
+					s8_append(&indented, '\t');
 				}
-			}
 
-			delete_runes(whitespace, cursor_pos);
-		} else if(ch == tab && selection_valid) {
-			b32 newline = 1;
-			isize begin = selection_begin();
-			isize end   = selection_end();
-
-			for(isize i = begin; i <= end; ++i) {
-				int rune = buffer_get(buf, i);
-
-				if(newline && rune != '\n') {
-					newline = 0;
-
-					if(modifiers & 1) {
-						if(rune == '\t') {
-							delete_rune(i);
-							end--;
-						}
-					} else {
-						insert_rune(i, '\t');
-						end++;
-					}
+				if(!newline || rune != '\t' || !(modifiers & 1)) {
+					s8_append(&indented, rune);
 				}
 
 				newline = rune == '\n';
 			}
 
+			if(indented.length != lines.length) {
+				edit_begin();
+				delete_runes(begin, end);
+				insert_runes(begin, indented);
+				edit_end();
+			}
+
 			selection[0] = begin;
-			selection[1] = end;
+			selection[1] = last + indented.length - lines.length;
 			selection_valid = 1;
+			free(lines.data);
+			free(indented.data);
 		} else {
+			edit_begin();
 			erase_selection();
 
 			if(ch == enter || ch == '\n') {
-				s8 indent = {0};
-				indent.data = arena_alloc(&memory, 1, 1, 80, 0);
-				s8_append(&indent, '\n');
-
 				isize bol = buffer_bol(buf, cursor_pos);
 				isize eol = buffer_eol(buf, cursor_pos);
+				isize indent_end = scan_runes(scan_nonblank, bol, eol);
 
-				for(isize i = bol; i < eol; ++i) {
-					int rune = buffer_get(buf, i);
-
-					if(rune != ' ' && rune != '\t') {
-						break;
-					}
-
-					s8_append(&indent, rune);
-				}
-
-				isize whitespace = cursor_pos;
-
-				for(; whitespace > bol; --whitespace) {
-					int rune = buffer_get(buf, whitespace - 1);
-
-					if(rune != ' ' && rune != '\t') {
-						break;
-					}
-				}
+				s8 indent = { indent_end - bol + 1, arena_alloc(&memory, 1, 1, indent_end - bol + 1, 0) };
+				indent.data[0] = '\n';
+				buffer_copy(buf, bol, indent_end, indent.data + 1);
 
-				delete_runes(whitespace, cursor_pos);
+				isize whitespace = scan_runes_back(scan_nonblank_back, bol, cursor_pos);
+				delete_runes(whitespace < 0 ? bol : whitespace + 1, cursor_pos);
 				insert_runes(cursor_pos, indent);
 			} else {
 				insert_rune(cursor_pos, ch);
 			}
+
+			edit_end();
 		}
 
 		gui_reflow();
 	}
+
+	long_follow();
 }
 
 b32
@@ -566,9 +932,31 @@ gui_exit(void) {
 	return 1;
 }
 
+/* Stops and joins the render workers. Frames drawn after this are drawn by the UI thread alone. */
+void
+gui_close(void) {
+	if(render.threads <= 0) {
+		return;
+	}
+
+	mutex_lock(&render.lock);
+	render.quit = true;
+	condvar_broadcast(&render.wake);
+	mutex_unlock(&render.lock);
+
+	for(int t = 0; t < render.threads; ++t) {
+		thread_join(render.workers[t]);
+	}
+
+	mutex_free(&render.lock);
+	condvar_free(&render.wake);
+	condvar_free(&render.done);
+	render.threads = -1;
+}
+
 static void
 clip_rect(int *x, int *y, int *w, int *h) {
-	dimensions dim = gui_dimensions();
+	dimensions dim = render.dim;
 	int xmin = *x < 0 ? 0 : *x;
 	int ymin = *y < 0 ? 0 : *y;
 	int xmax = *x + *w < dim.w ? *x + *w : dim.w;
@@ -582,36 +970,150 @@ clip_rect(int *x, int *y, int *w, int *h) {
 static void
 draw_rect(int x, int y, int w, int h, color rgb) {
 	clip_rect(&x, &y, &w, &h);
-	dimensions dim = gui_dimensions();
+	dimensions dim = render.dim;
 	unsigned *row = pixels + y * dim.w + x;
 
 	for(int i = 0; i < h; ++i) {
-		unsigned *pixel = row;
+		draw_fill(row, w, rgb);
+		row += dim.w;
+	}
+}
 
-		for(int j = 0; j < w; ++j) {
-			*pixel++ = rgb;
-		}
+/* Mixes rgb into the pixels of the rect, alpha going from 0 to 255. */
+static void
+draw_tint(int x, int y, int w, int h, color rgb, unsigned alpha) {
+	clip_rect(&x, &y, &w, &h);
+	dimensions dim = render.dim;
+	unsigned *row = pixels + y * dim.w + x;
 
+	for(int i = 0; i < h; ++i) {
+		draw_blend(row, w, rgb, alpha);
 		row += dim.w;
 	}
 }
 
 static void
 draw_cursor(int x, int y, int w) {
-	int cursor_h   = gui_font_height();
-	dimensions dim = gui_dimensions();
+	int cursor_h   = render.line_height;
+	dimensions dim = render.dim;
 	clip_rect(&x, &y, &w, &cursor_h);
 	unsigned *row = pixels + y * dim.w + x;
 
 	for(int i = 0; i < cursor_h; ++i) {
-		unsigned *pixel = row;
+		draw_invert(row, w);
+		row += dim.w;
+	}
+}
+
+/* Draws a dirty row from what gui_redraw looked up for it, on any thread. */
+static void
+draw_row(arena scratch, isize r) {
+	dimensions dim         = render.dim;
+	int        line_height = render.line_height;
+	isize      rows        = display_rows.length;
+	int        y           = MARGIN_TOP + (int)r * line_height;
+	isize      first       = display_rows.data[r].first;
+	isize      last        = r + 1 < rows ? display_rows.data[r + 1].first : display.length;
+	isize      runs_end    = r + 1 < rows ? display_rows.data[r + 1].run : display_runs.length;
+	int        eol         = render.eols[r];
+
+	draw_rect(MARGIN_L, y, dim.w - MARGIN_L - MARGIN_R, line_height, render.bg);
+	draw_rect(dim.w - MARGIN_R, y, MARGIN_R, line_height, eol == '\n' || eol == -1 ? render.margin : rgb(0, 255, 0));
+
+	for(isize k = display_rows.data[r].run; k < runs_end; ++k) {
+		run  *run = display_runs.data + k;
+		cell  a   = display.data[run->first];
+
+		if(run->trailing) {
+			cell b = display.data[run->last - 1];
+			draw_rect(a.x, a.y, b.x + b.w - a.x, line_height, rgb(255, 0, 0));
+			continue;
+		}
+
+		color fg   = run->event >= 0 ? styles[run->event].color : 0;
+		bool  bold = run->event >= 0 && styles[run->event].bold;
+		draw_text(scratch, a.x, a.y, render.texts[k], fg, render.bg, bold);
+	}
+
+	isize a = render.tinted[0] > first ? render.tinted[0] : first;
+	isize b = render.tinted[1] < last  ? render.tinted[1] : last;
+
+	if(a < b) {
+		int x = display.data[a].x;
+		draw_tint(x, y, display.data[b - 1].x + display.data[b - 1].w - x, line_height, rgb(0, 120, 255), 48);
+	}
+
+	if(drawn.cursor.y == y) {
+		draw_cursor(drawn.cursor.x, drawn.cursor.y, drawn.cursor.w);
+	}
+}
+
+/* Returns the runes of a run with its tabs expanded, and puts their glyphs in the atlas. */
+static s8
+run_text(arena *memory, run *run) {
+	bool bold = run->event >= 0 && styles[run->event].bold;
+	s8   runes;
+	runes.data   = arena_alloc(memory, 1, 1, 4 * (run->last - run->first), ALLOC_NOZERO);
+	runes.length = 0;
+
+	for(isize k = run->first; k < run->last; ++k) {
+		int rune = buffer_get(buf, display.data[k].pos);
 
-		for(int j = 0; j < w; ++j) {
-			*pixel = ~*pixel;
-			pixel++;
+		if(rune == '\t') {
+			memcpy(runes.data + runes.length, "    ", 4);
+			runes.length += 4;
+		} else {
+			s8_append(&runes, rune);
 		}
+	}
 
-		row += dim.w;
+	for(isize k = 0; k < runes.length; ++k) {
+		glyph_get(&glyphs, (unsigned char)runes.data[k], bold);
+	}
+
+	return runes;
+}
+
+/*
+ * Draws runes of one style, with their cells filled with bg. Unless the
+ * platform draws them itself, their glyphs from the atlas are put side by side
+ * in one mask, which is then composited a row at a time.
+ */
+static void
+draw_text(arena scratch, int x, int y, s8 runes, color fg, color bg, bool bold) {
+	if(gui_text(x, y, runes, fg, bg, bold)) {
+		return;
+	}
+
+	dimensions dim = render.dim;
+	int        w   = 0;
+	int        h   = render.line_height;
+
+	// Every miss is filled first, as a miss can move the masks of the atlas
+	for(isize k = 0; k < runes.length; ++k) {
+		w += glyph_get(&glyphs, (unsigned char)runes.data[k], bold).w;
+	}
+
+	unsigned char *mask = arena_alloc(&scratch, 1, 1, (isize)w * h, ALLOC_NOZERO);
+
+	for(isize k = 0, at = 0; k < runes.length; ++k) {
+		glyph g = glyph_get(&glyphs, (unsigned char)runes.data[k], bold);
+
+		for(int j = 0; j < h; ++j) {
+			memcpy(mask + j * w + at, g.mask + j * g.w, (size_t)g.w);
+		}
+
+		at += g.w;
+	}
+
+	int cx = x;
+	int cy = y;
+	int cw = w;
+	int ch = h;
+	clip_rect(&cx, &cy, &cw, &ch);
+
+	for(int j = 0; j < ch; ++j) {
+		draw_mask(pixels + (cy + j) * dim.w + cx, mask + (cy - y + j) * w + (cx - x), cw, fg, bg);
 	}
 }
 
@@ -632,6 +1134,15 @@ insert_runes2(isize at, s8 runes, bool edit) {
 		log_clear(&redo);
 	}
 
+	if(loading.load) {
+		s8 copy = { runes.length, malloc((size_t)runes.length) };
+		memcpy(copy.data, runes.data, (size_t)runes.length);
+		*push(&loading.edits) = (preview_edit) { at, at, copy };
+	}
+
+	layout_edit(at, at, runes.length);
+	long_edit(at, at, runes.length);
+	wrap_edit(buffer_line_at(buf, at), 0, scan_count_newlines(runes.data, runes.length));
 	buffer_insert_runes(buf, at, runes);
 	syntax_insert(syntax, buf, at, at + runes.length);
 	set_cursor_pos(at + runes.length);
@@ -650,43 +1161,155 @@ delete_runes(isize begin, isize end) {
 static void
 delete_runes2(isize begin, isize end, bool edit) {
 	if(edit) {
-		s8 erased = {0};
-		erased.data = malloc((size_t)(end - begin));
-		for(isize i = begin; i < end; ++i) {
-			s8_append(&erased, buffer_get(buf, i));
-		}
+		s8 erased = { end - begin, malloc((size_t)(end - begin)) };
+		buffer_copy(buf, begin, end, erased.data);
 		log_push_erase(&undo, begin, erased);
 		log_clear(&redo);
 	}
 
-	buffer_delete_runes(buf, begin, end);
+	if(loading.load) {
+		*push(&loading.edits) = (preview_edit) { begin, end, {0} };
+	}
+
+	layout_edit(begin, end, 0);
+	long_edit(begin, end, 0);
+	isize line = buffer_line_at(buf, begin);
+	wrap_edit(line, buffer_line_at(buf, end) - line, 0);
+	syntax_begin(syntax);
 	syntax_delete(syntax, buf, begin, end);
+	buffer_delete_runes(buf, begin, end);
+	syntax_commit(syntax, buf);
 	set_cursor_pos(begin);
 }
 
+/* Groups the edits up to edit_end into one undo step and one reparse. */
+static void
+edit_begin(void) {
+	syntax_begin(syntax);
+	log_begin(&undo);
+}
+
+static void
+edit_end(void) {
+	log_end(&undo);
+	syntax_commit(syntax, buf);
+}
+
 static b32
 buffer_is_dirty(buffer *buf) {
 	return undo.length != 0;
 }
 
-/* GUI IMPLEMENTATION END */
+/*
+ * Waits for the file to load and replaces the preview with it. The loaded
+ * buffer starts with the preview, so the edits to the preview are made again
+ * at the same positions and the rest of the file follows them.
+ */
+static void
+finish_loading(void) {
+	buffer *loaded = load_end(loading.load);
+	loading.load = 0;
 
-/* CURSOR IMPLEMENTATION BEGIN */
+	for(isize i = 0; i < loading.edits.length; ++i) {
+		preview_edit e = loading.edits.data[i];
 
-static isize
-set_cursor_pos(isize pos) {
-	cursor_state = 0;
-	cursor_x = 0;
-	cursor_pos = pos;
-	selection_valid = 0;
-	return cursor_pos;
-}
+		if(loaded && e.end > e.begin) {
+			buffer_delete_runes(loaded, e.begin, e.end);
+		} else if(loaded) {
+			buffer_insert_runes(loaded, e.begin, e.runes);
+		}
 
-/* CURSOR IMPLEMENTATION END */
+		free(e.runes.data);
+	}
 
-/* SELECTION IMPLEMENTATION BEGIN */
+	loading.edits.length = 0;
 
-static isize
+	if(!loaded) {
+		loading.failed = 1;
+		return;
+	}
+
+	// The rest of the file follows the last line of the preview
+	isize length = buffer_length(buf);
+	isize lines  = buffer_line_count(buf);
+	wrap_edit(lines - 1, 0, buffer_line_count(loaded) - lines);
+	buffer_free(buf);
+	buf = loaded;
+	syntax_insert(syntax, buf, length, buffer_length(buf));
+	gui_reflow();
+}
+
+/* Runs a forward scan kernel over [begin, end). Returns the position of the first match or end. */
+static isize
+scan_runes(isize (*scan)(const char*, isize), isize begin, isize end) {
+	buffer_iter it = buffer_iter_begin(buf, begin, end);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk);) {
+		isize i = scan(chunk.data, chunk.length);
+
+		if(i < chunk.length) {
+			return it.pos - chunk.length + i;
+		}
+	}
+
+	return end;
+}
+
+/*
+ * Runs a backward scan kernel over [begin, end), a block of SCAN_BLOCK runes
+ * at a time from the end, so a match near the end is found without reading
+ * the rest. Returns the position of the last match or -1.
+ */
+static isize
+scan_runes_back(isize (*scan)(const char*, isize), isize begin, isize end) {
+	for(isize to = end, from; to > begin; to = from) {
+		from = to - SCAN_BLOCK > begin ? to - SCAN_BLOCK : begin;
+
+		isize       found = -1;
+		buffer_iter it    = buffer_iter_begin(buf, from, to);
+
+		// The iterator only goes forward, so the last match of the block wins
+		for(s8 chunk; buffer_iter_next(&it, &chunk);) {
+			isize i = scan(chunk.data, chunk.length);
+
+			if(i >= 0) {
+				found = it.pos - chunk.length + i;
+			}
+		}
+
+		if(found >= 0) {
+			return found;
+		}
+	}
+
+	return -1;
+}
+
+/* GUI IMPLEMENTATION END */
+
+/* CURSOR IMPLEMENTATION BEGIN */
+
+static isize
+set_cursor_pos(isize pos) {
+	cursor_moved = gui_time();
+	cursor_x = 0;
+	cursor_pos = pos;
+	selection_valid = 0;
+	return cursor_pos;
+}
+
+/* Whether the cursor is shown at gui_time now. It blinks only in the active window. */
+static bool
+cursor_visible(isize now) {
+	isize elapsed = now - cursor_moved;
+	return !gui_is_active() || elapsed >= BLINK_STOP || elapsed / BLINK_PERIOD % 2 == 0;
+}
+
+/* CURSOR IMPLEMENTATION END */
+
+/* SELECTION IMPLEMENTATION BEGIN */
+
+static isize
 selection_begin(void) {
 	assert(selection_valid);
 	return selection[0] < selection[1] ? selection[0] : selection[1];
@@ -711,8 +1334,8 @@ erase_selection(void) {
 
 static cell
 xy_at_buffer_pos(isize pos) {
-	assert(display_pos <= pos && pos < display_pos + display.length);
-	return display.data[pos - display_pos];
+	assert(display_shows(pos));
+	return display.data[display_index(pos)];
 }
 
 static isize
@@ -732,25 +1355,1134 @@ buffer_pos_at_xy(int x, int y) {
 
 	for(isize i = lo; i < display.length; ++i) {
 		if(display.data[i].x > x || display.data[i].y > y) {
-			return i-1 + display_pos;
+			return display.data[i > 0 ? i - 1 : 0].pos;
+		}
+	}
+
+	return display.data[display.length - 1].pos;
+}
+
+/*
+ * Returns the index in display of the first rune at or after pos. The runes
+ * of a long line that are scrolled out of view have no cells, so this is
+ * pos - display_pos only until the first long line.
+ */
+static isize
+display_index(isize pos) {
+	isize k = pos - display_pos;
+
+	if(0 <= k && k < display.length && display.data[k].pos == pos) {
+		return k;
+	}
+
+	isize lo = 0;
+	isize hi = display.length;
+
+	while(lo < hi) {
+		isize mid = (lo + hi) >> 1;
+
+		if(display.data[mid].pos < pos) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
 
-	return display_pos + display.length - 1;
+	return lo;
+}
+
+/* Whether the rune at pos has a cell on the display. */
+static bool
+display_shows(isize pos) {
+	isize k = display_index(pos);
+	return k < display.length && display.data[k].pos == pos;
 }
 
 static void
 display_scroll(int num_lines) {
+	isize pos = display_pos;
+
 	if(num_lines >= 0) {
-		display_pos = buffer_pos_at_xy(display.data[0].x, display.data[0].y + (num_lines + 1) * gui_font_height());
+		pos = buffer_pos_at_xy(display.data[0].x, display.data[0].y + (num_lines + 1) * gui_font_height());
 	} else {
-		while(display_pos > 0 && num_lines) {
-			display_pos = buffer_bol(buf, display_pos - 1);
+		while(pos > 0 && num_lines) {
+			pos = buffer_bol(buf, pos - 1);
 			num_lines++;
 		}
 	}
 
+	display_move(pos);
+}
+
+/*
+ * Moves the display to begin at pos. The rows that stay on the display keep
+ * their layout and move by whole rows, and only the runes that come into view
+ * are laid out. The result is the same as that of gui_reflow.
+ */
+static void
+display_move(isize pos) {
+	dimensions dim         = gui_dimensions();
+	int        line_height = gui_font_height();
+	int        display_bot = dim.h - MARGIN_BOT - line_height;
+	isize      moved_pos   = display_pos;
+	isize      keep        = 0; // First moved cell that stays on the display
+	int        x           = MARGIN_L;
+	int        y           = MARGIN_TOP;
+	isize      bol         = buffer_bol(buf, pos);
+
+	// A long line is on one row, so a display that begins in it begins with it
+	if(long_is(bol, buffer_eol(buf, bol))) {
+		pos = bol;
+	}
+
+	if(pos == display_pos) {
+		return;
+	}
+
+	if(pos > moved_pos) {
+		keep = display_index(pos);
+	}
+
+	{ // The display becomes display_moved, and the other way around
+		typeof(display)    cells = display;
+		typeof(highlights) runs  = highlights;
+		display           = display_moved;
+		highlights        = highlights_moved;
+		display_moved     = cells;
+		highlights_moved  = runs;
+		display.length    = 0;
+		highlights.length = 0;
+		display_pos       = pos;
+	}
+
+	if(pos > moved_pos) {
+		// Only a display that begins a row keeps its rows
+		if(keep == 0 || keep >= display_moved.length || display_moved.data[keep].y == display_moved.data[keep - 1].y || display_moved.data[keep].pos > buffer_eol(buf, pos)) {
+			goto REFLOW;
+		}
+	} else {
+		display_layout(pos, moved_pos, &x, &y);
+
+		if(y >= display_bot) {
+			goto DONE;
+		}
+
+		highlight_t *last = highlights.length ? &highlights.data[highlights.length - 1] : 0;
+
+		if(last && last->end > moved_pos) {
+			last->end = moved_pos;
+		}
+
+		// The moved display has to begin a row here too
+		cell first = display_moved.data[0];
+		bool wraps = buffer_get(buf, moved_pos) != '\n' && x + first.w > dim.w - MARGIN_R;
+
+		if(x != MARGIN_L && !wraps) {
+			goto REFLOW;
+		}
+	}
+
+	int   row_y = x == MARGIN_L ? y : y + line_height;
+	int   shift = row_y - display_moved.data[keep].y;
+	isize end   = keep;
+	isize next  = display_moved.data[keep].pos; // Where the layout goes on after the kept runes
+
+	for(; end < display_moved.length && display_moved.data[end].y + shift < display_bot; ++end) {
+		cell *c = push(&display);
+		*c    = display_moved.data[end];
+		c->y += shift;
+		next  = c->pos + 1;
+	}
+
+	for(isize k = 0; k < highlights_moved.length; ++k) {
+		highlight_t h = highlights_moved.data[k];
+		h.begin = h.begin > display_moved.data[keep].pos ? h.begin : display_moved.data[keep].pos;
+		h.end   = h.end < next ? h.end : next;
+
+		if(h.begin < h.end) {
+			*push(&highlights) = h;
+		}
+	}
+
+	if(end > keep) {
+		cell  last = display.data[display.length - 1];
+		int   rune = buffer_get(buf, last.pos);
+
+		if(rune == -1) {
+			goto SCROLLED;
+		}
+
+		x = rune == '\n' ? MARGIN_L : last.x + last.w;
+		y = rune == '\n' ? last.y + line_height : last.y;
+	}
+
+	display_layout(next, buffer_length(buf) + 1, &x, &y);
+
+SCROLLED:
+	scrolled += shift;
+DONE:
+	display_index_rows();
+	frame_wanted = true;
+	return;
+
+REFLOW:
+	gui_reflow();
+}
+
+/*
+ * Moves the display so that pos is on its last row, with one lookup in the
+ * wrap index and one reflow. Only the lines that end up on the display are
+ * laid out to count their rows.
+ */
+static void
+display_jump(isize pos) {
+	int   line_height = gui_font_height();
+	int   display_bot = gui_dimensions().h - MARGIN_BOT - line_height;
+	isize rows        = (display_bot - MARGIN_TOP + line_height - 1) / line_height;
+	isize line        = buffer_line_at(buf, pos);
+	isize above       = wrap_layout(buffer_line_begin(buf, line), pos + 1, 0, 0) - 1;
+
+	wrap_index();
+	wrap_count(line);
+
+	for(isize l = line, need = rows - 1 - above; l > 0 && need > 0;) {
+		need -= wrap_count(--l);
+	}
+
+	isize row = wrap_row(line) + above - (rows - 1);
+	row = row > 0 ? row : 0;
+
+	isize top = wrap_line_at_row(row);
+	isize bol = buffer_line_begin(buf, top);
+	wrap_layout(bol, buffer_eol(buf, bol) + 1, row - wrap_row(top), &display_pos);
+	gui_reflow();
+}
+
+/* Moves the display so that row of the wrap index is its first row, with one lookup and one reflow. */
+static void
+display_jump_row(isize row) {
+	wrap_index();
+
+	isize top = wrap_line_at_row(row);
+	isize bol = buffer_line_begin(buf, top);
+	wrap_count(top);
+	wrap_layout(bol, buffer_eol(buf, bol) + 1, row - wrap_row(top), &display_pos);
 	gui_reflow();
 }
 
+/*
+ * Lays out the runes from begin up to end, or up to the bottom of the display,
+ * going on from x and y. Leaves x and y where the next rune would go unless
+ * it wraps. Whole lines come from the layout cache.
+ */
+static void
+display_layout(isize begin, isize end, int *x, int *y) {
+	dimensions  dim         = gui_dimensions();
+	int         line_height = gui_font_height();
+	int         display_bot = dim.h - MARGIN_BOT - line_height;
+	int         right       = dim.w - MARGIN_R;
+	isize       bol         = buffer_bol(buf, begin);
+	isize       eol         = buffer_eol(buf, bol);
+	isize       i           = begin;
+	bool        lit         = false; // Whether highlights are set up from i on
+	highlight_t highlight;
+
+	// The row of a long line is laid out at once, so going on inside one goes on after it
+	if(begin > bol && long_is(bol, eol)) {
+		i   = eol + 1;
+		*x  = MARGIN_L;
+		*y += line_height;
+	}
+
+	// Wrapping only shortens what fits, so the visible runes end before this line
+	isize rows = (display_bot - *y) / line_height + 1;
+	isize line = buffer_line_at(buf, i) + rows;
+	isize stop = line < buffer_line_count(buf) ? buffer_line_begin(buf, line) : buffer_length(buf);
+	stop = stop < end ? stop : end;
+
+	while(i < end && *y < display_bot) {
+		bol = *x == MARGIN_L && (i == 0 || buffer_get(buf, i - 1) == '\n') ? i : -1;
+		eol = bol >= 0 ? buffer_eol(buf, bol) : -1;
+
+		if(bol >= 0 && long_is(bol, eol)) {
+			if(lit) {
+				syntax_highlight_end(syntax);
+				lit = false;
+			}
+
+			display_long(bol, eol, *y);
+
+			i   = eol + 1;
+			*x  = MARGIN_L;
+			*y += line_height;
+			continue;
+		}
+
+		// Long lines are left out, as highlighting looks at whole lines
+		if(!lit) {
+			syntax_highlight_begin(syntax, buf, i, long_next(i, stop));
+			lit = true;
+		}
+
+		layout *cached = bol >= 0 ? layout_line(i, end) : 0;
+
+		if(cached) {
+			int top = *y;
+
+			// A rune is placed while the row before it is above display_bot
+			for(isize k = 0; k < cached->cells.length && *y < display_bot; ++k, ++i) {
+				cell *c = push(&display);
+				*c     = cached->cells.data[k];
+				c->y   = top + c->y * line_height;
+				c->pos = i;
+				*x     = c->x + c->w;
+				*y    = c->y;
+			}
+
+			if(i == cached->begin + cached->length) {
+				*x  = MARGIN_L;
+				*y += line_height;
+			}
+
+			continue;
+		}
+
+		int rune = buffer_get(buf, i);
+
+		if(rune == -1) {
+			cell *c = push(&display);
+			*c = (cell) { *x, *y, 8, false, i };
+			display_trail(display.length - 1);
+			break;
+		}
+
+		if(!highlights.length || highlights.data[highlights.length - 1].end <= i) {
+			if(syntax_highlight_next(syntax, buf, i, &highlight)) {
+				*push(&highlights) = highlight;
+			}
+		}
+
+		highlight_t *last = highlights.length ? &highlights.data[highlights.length - 1] : 0;
+		bool         bold = last && last->end > i && styles[last->event].bold;
+
+		*push(&display) = display_rune(i, rune, bold, right, line_height, x, y);
+
+		if(rune == '\n') {
+			display_trail(display.length - 1);
+		}
+
+		++i;
+	}
+
+	if(lit) {
+		syntax_highlight_end(syntax);
+	}
+}
+
+/* Lays out the runes of the long line from bol to eol that are in view, on a row at y. */
+static void
+display_long(isize bol, isize eol, int y) {
+	int   right = gui_dimensions().w - MARGIN_R;
+	isize at;
+	isize i     = long_pos(bol, eol, scroll_x, &at);
+	isize x     = MARGIN_L + at - scroll_x;
+
+	// Past its end the line only shows its newline, at the left
+	x = x > MARGIN_L ? x : MARGIN_L;
+
+	for(; i <= eol; ++i) {
+		int rune  = buffer_get(buf, i);
+		int width = rune == -1 ? 8 : long_width(rune);
+
+		if(x + width > right) {
+			break;
+		}
+
+		cell *c = push(&display);
+		*c = (cell) { (int)x, y, width, false, i };
+		x += width;
+
+		if(rune == '\n' || rune == -1) {
+			display_trail(display.length - 1);
+		}
+	}
+}
+
+/*
+ * Places the rune at pos at x and y, or on the next row if it does not fit
+ * before right, and moves x and y past it. Bold runes can be wider.
+ */
+static cell
+display_rune(isize pos, int rune, bool bold, int right, int line_height, int *x, int *y) {
+	int  width = rune == '\t' ? 4 * glyph_width(&glyphs, ' ', bold) : glyph_width(&glyphs, rune, bold);
+	cell c     = { *x, *y, width, false, pos };
+
+	if(rune == '\n') {
+		*x  = MARGIN_L;
+		*y += line_height;
+		return c;
+	}
+
+	if(*x + width > right) {
+		*x  = MARGIN_L;
+		*y += line_height;
+	}
+
+	c = (cell) { *x, *y, width, false, pos };
+	*x += width;
+	return c;
+}
+
+/* Marks the blanks right before the newline at display index k as trailing. */
+static void
+display_trail(isize k) {
+	for(isize j = k - 1; j >= 0 && !display.data[j].trailing; --j) {
+		int rune = buffer_get(buf, display.data[j].pos);
+
+		if(rune != ' ' && rune != '\t' && rune != '\r') {
+			break;
+		}
+
+		display.data[j].trailing = true;
+	}
+}
+
+/* Splits the display into rows and hashes what every row shows. */
+static void
+display_index_rows(void) {
+	int          line_height = gui_font_height();
+	int          display_bot = gui_dimensions().h - MARGIN_BOT - line_height;
+	highlight_t *highlight   = highlights.data;
+	highlight_t *end         = highlights.data + highlights.length;
+
+	// Blanks only trail once their newline is on the display
+	for(isize k = display.length - 1; k >= 0 && display.data[k].trailing; --k) {
+		display.data[k].trailing = false;
+	}
+
+	display_rows.length = 0;
+	display_runs.length = 0;
+	run *open = 0; // The run the next rune can join
+
+	for(isize k = 0; k < display.length; ++k) {
+		isize i  = display.data[k].pos;
+		cell  xy = display.data[k];
+
+		while(display_rows.length <= (xy.y - MARGIN_TOP) / line_height) {
+			*push(&display_rows) = (row) { k, display_runs.length, FNV_OFFSET };
+			open = 0;
+		}
+
+		while(highlight < end && highlight->end <= i) {
+			highlight++;
+		}
+
+		int rune  = buffer_get(buf, i);
+		int event = highlight < end && highlight->begin <= i && !xy.trailing ? (int)highlight->event : -1;
+
+		if(rune == '\n' || rune == -1) {
+			open = 0;
+		} else if(open && open->event == event && open->trailing == xy.trailing) {
+			open->last = k + 1;
+		} else {
+			open  = push(&display_runs);
+			*open = (run) { k, k + 1, event, xy.trailing };
+		}
+
+		int shown[] = { rune, xy.x, xy.w, xy.trailing, event + 1 };
+		row *r  = display_rows.data + display_rows.length - 1;
+		r->hash = hash(r->hash, shown, sizeof(shown));
+	}
+
+	// The row at display_bot only has the rune that wrapped there, if any
+	for(int y = MARGIN_TOP + (int)display_rows.length * line_height; y < display_bot + line_height; y += line_height) {
+		*push(&display_rows) = (row) { display.length, display_runs.length, 0 };
+	}
+}
+
 /* DISPLAY IMPLEMENTATION END */
+
+/* LAYOUT IMPLEMENTATION BEGIN */
+
+/*
+ * Returns the layout of the line at begin, from the cache when the line did
+ * not change, or 0 if the line is not kept because it is too long or does not
+ * end before end. Pushes the highlights of the line either way.
+ */
+static layout*
+layout_line(isize begin, isize end) {
+	isize       eol    = buffer_eol(buf, begin);
+	isize       length = eol + 1 - begin;
+	int         width  = gui_dimensions().w;
+	isize       first  = highlights.length;
+	highlight_t highlight;
+
+	if(eol >= buffer_length(buf) || eol >= end || length > LAYOUT_MAX) {
+		return 0;
+	}
+
+	for(isize i = begin; i <= eol; ++i) {
+		if(!highlights.length || highlights.data[highlights.length - 1].end <= i) {
+			if(syntax_highlight_next(syntax, buf, i, &highlight)) {
+				*push(&highlights) = highlight;
+			}
+		}
+	}
+
+	layout *line = layouts; // The line at begin, or the one to replace
+
+	for(isize k = 0; k < LAYOUT_LINES; ++k) {
+		if(layouts[k].length && layouts[k].begin == begin) {
+			line = layouts + k;
+			break;
+		}
+
+		if(layouts[k].used < line->used) {
+			line = layouts + k;
+		}
+	}
+
+	line->used = ++layout_clock;
+
+	bool  same  = line->length == length && line->begin == begin && line->width == width;
+	isize spans = 0;
+
+	for(isize k = first; k < highlights.length && same; ++k) {
+		highlight_t h = highlights.data[k];
+
+		if(styles[h.event].bold) {
+			same   = spans + 2 <= line->bold.length && line->bold.data[spans] == h.begin - begin && line->bold.data[spans + 1] == h.end - begin;
+			spans += 2;
+		}
+	}
+
+	if(same && spans == line->bold.length) {
+		return line;
+	}
+
+	line->begin        = begin;
+	line->length       = length;
+	line->width        = width;
+	line->cells.length = 0;
+	line->bold.length  = 0;
+
+	for(isize k = first; k < highlights.length; ++k) {
+		if(styles[highlights.data[k].event].bold) {
+			*push(&line->bold) = highlights.data[k].begin - begin;
+			*push(&line->bold) = highlights.data[k].end - begin;
+		}
+	}
+
+	int          x      = MARGIN_L;
+	int          y      = 0;
+	isize        blanks = 0; // Index of the first of the blanks before the rune
+	highlight_t *h      = highlights.data + first;
+
+	for(isize i = begin; i <= eol; ++i) {
+		int rune = buffer_get(buf, i);
+
+		while(h < highlights.data + highlights.length && h->end <= i) {
+			h++;
+		}
+
+		bool bold = h < highlights.data + highlights.length && h->begin <= i && styles[h->event].bold;
+		*push(&line->cells) = display_rune(i, rune, bold, width - MARGIN_R, 1, &x, &y);
+
+		if(rune == '\n') {
+			for(isize k = blanks; k < i - begin; ++k) {
+				line->cells.data[k].trailing = true;
+			}
+		} else if(rune != ' ' && rune != '\t' && rune != '\r') {
+			blanks = i - begin + 1;
+		}
+	}
+
+	return line;
+}
+
+/* Drops the lines that [begin, end) is deleted from or inserted into, and moves the ones after it. */
+static void
+layout_edit(isize begin, isize end, isize inserted) {
+	for(isize k = 0; k < LAYOUT_LINES; ++k) {
+		layout *line = layouts + k;
+		isize   last = line->begin + line->length;
+		bool    hit  = begin < end ? line->begin < end && begin < last : line->begin <= begin && begin < last;
+
+		if(hit) {
+			line->length = 0;
+		} else if(line->begin >= end) {
+			line->begin += inserted - (end - begin);
+		}
+	}
+}
+
+/* LAYOUT IMPLEMENTATION END */
+
+/* WRAP IMPLEMENTATION BEGIN */
+
+/* Returns the index in wrap.lines of the first counted line at or after line. */
+static isize
+wrap_find(isize line) {
+	isize lo = 0;
+	isize hi = wrap.lines.length;
+
+	while(lo < hi) {
+		isize mid = lo + (hi - lo) / 2;
+
+		if(wrap.lines.data[mid].line < line) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* Adds delta to the rows of line in the tree. */
+static void
+wrap_add(isize line, isize delta) {
+	for(isize i = line + 1; i < wrap.tree.length; i += i & -i) {
+		wrap.tree.data[i] += delta;
+	}
+}
+
+/* Returns the rows past the first of the lines before line. */
+static isize
+wrap_extra(isize line) {
+	isize extra = 0;
+
+	for(isize i = line; i > 0; i -= i & -i) {
+		extra += wrap.tree.data[i];
+	}
+
+	return extra;
+}
+
+/* Starts the index over if the width changed, or if it lost track of the lines. Every line counts as one row. */
+static void
+wrap_index(void) {
+	int   width = gui_dimensions().w;
+	isize lines = buffer_line_count(buf);
+
+	if(wrap.width == width && wrap.tree.length == lines + 1) {
+		return;
+	}
+
+	wrap.width        = width;
+	wrap.tree.length  = 0;
+	wrap.lines.length = 0;
+
+	for(isize l = 0; l <= lines; ++l) {
+		*push(&wrap.tree) = 0;
+	}
+}
+
+/* Lays out line to count its rows and puts them in the index. */
+static int
+wrap_count(isize line) {
+	isize    bol   = buffer_line_begin(buf, line);
+	int      rows  = wrap_layout(bol, buffer_eol(buf, bol) + 1, 0, 0);
+	isize    k     = wrap_find(line);
+	wrapped *found = k < wrap.lines.length && wrap.lines.data[k].line == line ? wrap.lines.data + k : 0;
+
+	wrap_add(line, rows - (found ? found->rows : 1));
+
+	if(found && rows > 1) {
+		found->rows = rows;
+	} else if(found) {
+		wrap.lines.length--;
+		memmove(found, found + 1, (size_t)(wrap.lines.length - k) * sizeof(wrapped));
+	} else if(rows > 1) {
+		push(&wrap.lines);
+		memmove(wrap.lines.data + k + 1, wrap.lines.data + k, (size_t)(wrap.lines.length - 1 - k) * sizeof(wrapped));
+		wrap.lines.data[k] = (wrapped) { line, rows };
+	}
+
+	return rows;
+}
+
+/*
+ * Follows an edit that replaces the lines from line through line + removed
+ * with line through line + added. Their counts are forgotten and the counted
+ * lines after them move, so it takes O((counted lines after line + lines
+ * added or removed) log n) rather than a pass over every line.
+ */
+static void
+wrap_edit(isize line, isize removed, isize added) {
+	if(!wrap.tree.length) {
+		return;
+	}
+
+	isize first = wrap_find(line);
+	isize kept  = first;
+
+	// Take the lines from line on out of the tree so that it can grow or shrink at the end
+	for(isize k = first, n = wrap.lines.length; k < n; ++k) {
+		wrapped w = wrap.lines.data[k];
+		wrap_add(w.line, 1 - w.rows);
+
+		if(w.line > line + removed) {
+			w.line += added - removed;
+			wrap.lines.data[kept++] = w;
+		}
+	}
+
+	isize length = wrap.tree.length + added - removed;
+	wrap.lines.length = kept;
+
+	if(length < wrap.tree.length) {
+		wrap.tree.length = length;
+	}
+
+	while(wrap.tree.length < length) {
+		// The lines the new entry sums are all before it, and the ones past line are 0 for now
+		isize i = wrap.tree.length;
+		*push(&wrap.tree) = wrap_extra(i - 1) - wrap_extra(i - (i & -i));
+	}
+
+	for(isize k = first; k < kept; ++k) {
+		wrap_add(wrap.lines.data[k].line, wrap.lines.data[k].rows - 1);
+	}
+}
+
+/* Returns the rows of the lines before line. */
+static isize
+wrap_row(isize line) {
+	return line + wrap_extra(line);
+}
+
+/* Returns the line that row is on, or the last line if the rows end before it. */
+static isize
+wrap_line_at_row(isize row) {
+	isize line = 0; // Lines whose rows all come before row
+	isize step = 1;
+
+	while(2 * step < wrap.tree.length) {
+		step *= 2;
+	}
+
+	for(; step; step /= 2) {
+		// The step lines up to line + step take a row each and the rows past the first in the tree
+		if(line + step < wrap.tree.length && step + wrap.tree.data[line + step] <= row) {
+			line += step;
+			row  -= step + wrap.tree.data[line];
+		}
+	}
+
+	return line < wrap.tree.length - 1 ? line : wrap.tree.length - 2;
+}
+
+/*
+ * Lays out [begin, end) on its own from the start of a row, the way
+ * display_layout does. Returns the rows it takes and sets *start, if given,
+ * to the position of the first rune on row.
+ */
+static int
+wrap_layout(isize begin, isize end, isize row, isize *start) {
+	int         right = gui_dimensions().w - MARGIN_R;
+	int         x     = MARGIN_L;
+	int         y     = 0;
+	bool        bold  = false;
+	isize       until = begin; // End of the last highlight
+	highlight_t highlight;
+
+	if(start) {
+		*start = begin;
+	}
+
+	if(long_is(begin, buffer_eol(buf, begin))) {
+		return 1;
+	}
+
+	syntax_highlight_begin(syntax, buf, begin, end);
+
+	for(isize i = begin; i < end; ++i) {
+		int rune = buffer_get(buf, i);
+
+		if(rune == -1) {
+			break;
+		}
+
+		if(until <= i) {
+			bold = false;
+
+			if(syntax_highlight_next(syntax, buf, i, &highlight)) {
+				bold  = styles[highlight.event].bold;
+				until = highlight.end;
+			}
+		}
+
+		int top = y;
+		display_rune(i, rune, bold, right, 1, &x, &y);
+
+		if(rune != '\n' && y != top && y == row && start) {
+			*start = i;
+		}
+
+		if(rune == '\n') {
+			y = top;
+		}
+	}
+
+	syntax_highlight_end(syntax);
+	return y + 1;
+}
+
+/* WRAP IMPLEMENTATION END */
+
+/* LONG LINE IMPLEMENTATION BEGIN */
+
+/* Whether the line from bol to its newline at eol is scrolled sideways. */
+static bool
+long_is(isize bol, isize eol) {
+	return eol - bol > LONG_LINE;
+}
+
+/* Returns the first long line that begins after the line of pos and before stop, or stop. */
+static isize
+long_next(isize pos, isize stop) {
+	for(isize line = buffer_line_at(buf, pos) + 1; line < buffer_line_count(buf); ++line) {
+		isize bol = buffer_line_begin(buf, line);
+
+		if(bol >= stop) {
+			break;
+		}
+
+		if(long_is(bol, buffer_eol(buf, bol))) {
+			return bol;
+		}
+	}
+
+	return stop;
+}
+
+/* Returns the x of the rune at pos in the long line at bol, from the start of the line. */
+static isize
+long_x(isize bol, isize pos) {
+	long_line *line = long_checkpoints(bol);
+	isize      k    = (pos - bol) / LONG_STEP;
+
+	for(; line->x.length <= k; ) {
+		isize from = bol + (line->x.length - 1) * LONG_STEP;
+		isize x    = line->x.data[line->x.length - 1];
+
+		for(isize i = from; i < from + LONG_STEP; ++i) {
+			x += long_width(buffer_get(buf, i));
+		}
+
+		*push(&line->x) = x;
+	}
+
+	isize x = line->x.data[k];
+
+	for(isize i = bol + k * LONG_STEP; i < pos; ++i) {
+		x += long_width(buffer_get(buf, i));
+	}
+
+	return x;
+}
+
+/*
+ * Returns the first rune of the long line from bol to eol that starts at or
+ * after x, or eol if none does, and sets *at to where it starts.
+ */
+static isize
+long_pos(isize bol, isize eol, isize x, isize *at) {
+	long_line *line = long_checkpoints(bol);
+
+	// Checkpoints up to the first one past x
+	while(line->x.data[line->x.length - 1] < x && bol + line->x.length * LONG_STEP <= eol) {
+		long_x(bol, bol + line->x.length * LONG_STEP);
+	}
+
+	isize lo = 0;
+	isize hi = line->x.length - 1;
+
+	while(lo < hi) {
+		isize mid = (lo + hi + 1) >> 1;
+
+		if(line->x.data[mid] <= x) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	isize pos = bol + lo * LONG_STEP;
+	*at = line->x.data[lo];
+
+	for(; pos < eol && *at < x; ++pos) {
+		*at += long_width(buffer_get(buf, pos));
+	}
+
+	return pos;
+}
+
+/* Keeps the checkpoints before an edit to [begin, end) and moves the lines after it. */
+static void
+long_edit(isize begin, isize end, isize inserted) {
+	for(isize k = 0; k < LONG_LINES; ++k) {
+		long_line *line = long_lines + k;
+
+		if(!line->x.length) {
+			continue;
+		}
+
+		if(begin >= line->begin) {
+			isize kept = (begin - line->begin) / LONG_STEP + 1;
+			line->x.length = kept < line->x.length ? kept : line->x.length;
+		} else if(end <= line->begin) {
+			line->begin += inserted - (end - begin);
+		} else {
+			line->x.length = 0;
+		}
+	}
+}
+
+/* Scrolls long lines sideways until the cursor is in view, if it is on one. */
+static void
+long_follow(void) {
+	isize bol   = buffer_bol(buf, cursor_pos);
+	isize eol   = buffer_eol(buf, bol);
+	isize width = gui_dimensions().w - MARGIN_R - MARGIN_L;
+
+	if(!long_is(bol, eol)) {
+		return;
+	}
+
+	isize x = long_x(bol, cursor_pos);
+	isize w = cursor_pos < eol ? long_width(buffer_get(buf, cursor_pos)) : 8;
+
+	if(x >= scroll_x && x + w <= scroll_x + width) {
+		return;
+	}
+
+	// A quarter of the display is kept on the side the cursor moves to
+	scroll_x = x < scroll_x ? x - width / 4 : x + w - width + width / 4;
+	scroll_x = scroll_x > 0 ? scroll_x : 0;
+	gui_reflow();
+}
+
+/* Returns the checkpoints of the long line at bol, which has at least the one at bol. */
+static long_line*
+long_checkpoints(isize bol) {
+	long_line *line = long_lines; // The line at bol, or the one to replace
+
+	for(isize k = 0; k < LONG_LINES; ++k) {
+		if(long_lines[k].x.length && long_lines[k].begin == bol) {
+			line = long_lines + k;
+			break;
+		}
+
+		if(long_lines[k].used < line->used) {
+			line = long_lines + k;
+		}
+	}
+
+	line->used = ++layout_clock;
+
+	if(!line->x.length || line->begin != bol) {
+		line->begin    = bol;
+		line->x.length = 0;
+		*push(&line->x) = 0;
+	}
+
+	return line;
+}
+
+/* Returns the width of a rune of a long line, which is never bold. */
+static int
+long_width(int rune) {
+	return rune == '\t' ? 4 * glyph_width(&glyphs, ' ', false) : glyph_width(&glyphs, rune, false);
+}
+
+/* LONG LINE IMPLEMENTATION END */
+
+/* DAMAGE IMPLEMENTATION BEGIN */
+
+/*
+ * Moves the pixels of the drawn rows and their hashes down by dy, or up for a
+ * negative dy. The cursor and the selection drawn on them move along, and the
+ * rows that scroll into view get hashes that do not match.
+ */
+static void
+damage_scroll(int dy) {
+	dimensions dim         = gui_dimensions();
+	int        line_height = gui_font_height();
+	isize      rows        = drawn.rows.length;
+	isize      k           = (dy < 0 ? -dy : dy) / line_height;
+	unsigned  *top         = pixels + MARGIN_TOP * dim.w;
+
+	// Only the rows above the tag line move, the others are drawn again
+	isize whole = (dim.h - MARGIN_BOT - MARGIN_TOP) / line_height;
+	whole = whole < rows ? whole : rows;
+	int   h     = (int)whole * line_height;
+
+	if(k >= whole) {
+		drawn.rows.length  = 0;
+		drawn.cursor.y     = -1;
+		drawn.selection[0] = -1;
+		drawn.selection[1] = -1;
+		return;
+	}
+
+	if(dy < 0) {
+		memmove(top, top - dy * dim.w, (size_t)(h + dy) * (size_t)dim.w * sizeof(*top));
+		memmove(drawn.rows.data, drawn.rows.data + k, (size_t)(rows - k) * sizeof(*drawn.rows.data));
+		drawn.rows.length -= k;
+	} else {
+		memmove(top + dy * dim.w, top, (size_t)(h - dy) * (size_t)dim.w * sizeof(*top));
+		memmove(drawn.rows.data + k, drawn.rows.data, (size_t)(rows - k) * sizeof(*drawn.rows.data));
+
+		for(isize r = 0; r < k && r < display_rows.length; ++r) {
+			drawn.rows.data[r] = ~display_rows.data[r].hash;
+		}
+	}
+
+	for(isize r = dy < 0 ? whole - k : whole; r < drawn.rows.length && r < display_rows.length; ++r) {
+		drawn.rows.data[r] = ~display_rows.data[r].hash;
+	}
+
+	gui_invalidate(0, MARGIN_TOP, dim.w, h);
+
+	int bot = MARGIN_TOP + h - line_height; // y of the last row
+
+	if(drawn.cursor.y >= 0) {
+		drawn.cursor.y += dy;
+		drawn.cursor.y  = drawn.cursor.y < MARGIN_TOP || drawn.cursor.y > bot ? -1 : drawn.cursor.y;
+	}
+
+	if(drawn.selection[0] >= 0) {
+		int first = drawn.selection[0] + dy;
+		int last  = drawn.selection[1] + dy;
+
+		if(last < MARGIN_TOP || first > bot) {
+			drawn.selection[0] = drawn.selection[1] = -1;
+		} else {
+			drawn.selection[0] = first < MARGIN_TOP ? MARGIN_TOP : first;
+			drawn.selection[1] = last > bot ? bot : last;
+		}
+	}
+}
+
+/* Marks the rows from the one at y top to the one at y bot, unless top is -1. */
+static void
+damage_rows(bool *dirty, int top, int bot) {
+	int line_height = gui_font_height();
+
+	for(int y = top; top >= 0 && y <= bot; y += line_height) {
+		isize r = (y - MARGIN_TOP) / line_height;
+
+		if(r < display_rows.length) {
+			dirty[r] = true;
+		}
+	}
+}
+
+/* FNV-1a */
+static uint64_t
+hash(uint64_t h, const void *data, isize size) {
+	for(isize i = 0; i < size; ++i) {
+		h ^= ((const unsigned char*)data)[i];
+		h *= 0x100000001b3;
+	}
+
+	return h;
+}
+
+/* DAMAGE IMPLEMENTATION END */
+
+/* RENDER IMPLEMENTATION BEGIN */
+
+/* Draws the dirty rows, with the workers when there are enough of them. */
+static void
+render_frame(arena memory) {
+	if(render.count >= RENDER_ROWS && !render.threads) {
+		int cpus = thread_cpus();
+		cpus = cpus < RENDER_THREADS ? cpus : RENDER_THREADS;
+
+		mutex_init(&render.lock);
+		condvar_init(&render.wake);
+		condvar_init(&render.done);
+
+		while(render.threads < cpus - 1 && thread_start(render.workers + render.threads, render_worker, (void*)(intptr_t)render.threads)) {
+			render.threads++;
+		}
+
+		render.threads = render.threads ? render.threads : -1;
+	}
+
+	// Every thread draws with its own share of the memory left
+	int   helpers = render.count >= RENDER_ROWS && render.threads > 0 ? render.threads : 0;
+	isize share   = (memory.end - memory.begin - memory.offset) / (helpers + 1) - 64;
+	render.next   = 0;
+
+	if(!helpers || share <= 0) {
+		render_rows(memory);
+		return;
+	}
+
+	for(int t = 0; t < render.threads; ++t) {
+		char *begin = arena_alloc(&memory, 1, 64, share, ALLOC_NOZERO);
+		render.scratch[t] = (arena) { begin, begin + share, 0 };
+	}
+
+	mutex_lock(&render.lock);
+	render.frame++;
+	render.busy = render.threads;
+	condvar_broadcast(&render.wake);
+	mutex_unlock(&render.lock);
+
+	render_rows(memory);
+
+	mutex_lock(&render.lock);
+
+	while(render.busy) {
+		condvar_wait(&render.done, &render.lock);
+	}
+
+	mutex_unlock(&render.lock);
+}
+
+/* Draws rows until every dirty row is taken. */
+static void
+render_rows(arena scratch) {
+	for(isize k; (k = __atomic_fetch_add(&render.next, 1, __ATOMIC_RELAXED)) < render.count;) {
+		draw_row(scratch, render.rows[k]);
+	}
+}
+
+static void
+render_worker(void *arg) {
+	int   t    = (int)(intptr_t)arg;
+	isize seen = 0; // The last frame drawn
+
+	for(;;) {
+		mutex_lock(&render.lock);
+
+		while(render.frame == seen && !render.quit) {
+			condvar_wait(&render.wake, &render.lock);
+		}
+
+		if(render.quit) {
+			mutex_unlock(&render.lock);
+			return;
+		}
+
+		seen = render.frame;
+		mutex_unlock(&render.lock);
+
+		render_rows(render.scratch[t]);
+
+		mutex_lock(&render.lock);
+
+		if(--render.busy == 0) {
+			condvar_signal(&render.done);
+		}
+
+		mutex_unlock(&render.lock);
+	}
+}
+
+/* RENDER IMPLEMENTATION END */
@@ -29,18 +29,29 @@ typedef enum {
 
 void       gui_clipboard_put(buffer*, isize, isize);
 s8         gui_clipboard_get(void);
-int        gui_font_width(int);
+int        gui_font_width(int, bool);
 int        gui_font_height(void);
+
+/*
+ * The render workers call gui_text, and gui_glyph through the glyph atlas, as
+ * well as the UI thread, several of them at once, so both must be reentrant.
+ * gui_close stops the workers.
+ */
+void       gui_glyph(int, bool, unsigned char*, int, int);
+b32        gui_text(int, int, s8, color, color, bool);
+
 dimensions gui_dimensions(void);
-void       gui_text(int, int, s8);
-void       gui_set_text_color(color);
-void       gui_set_text_bold(bool);
-void       gui_set_bg_color(color);
+isize      gui_time(void);
+void       gui_invalidate(int, int, int, int);
 void       gui_redraw(arena);
 void       gui_reflow(void);
+int        gui_next_frame(void);
 void       gui_mouse(gui_event, int, int);
 void       gui_keyboard(arena, gui_event, int);
+void       gui_jump_line(isize);
+void       gui_jump_percent(int);
 b32        gui_exit(void);
+void       gui_close(void);
 b32        gui_is_active(void);
 b32        gui_file_open(arena*, const char*);
 
@@ -0,0 +1,54 @@
+; Highlights for C. Captures are named after the events in syntax.h, or
+; after a subcategory of one such as @string.escape. Captures with other
+; names, like the ones only used by predicates, are not highlighted.
+; Highlights do not overlap: a capture starting inside an earlier one is
+; dropped and of the captures starting together the longest wins.
+
+(comment) @comment
+
+(preproc_if
+  condition: (number_literal) @_condition
+  (#eq? @_condition "0")) @comment
+
+[
+  (string_literal)
+  (system_lib_string)
+  (char_literal)
+] @string
+
+(number_literal) @number
+
+[
+  (primitive_type)
+  (sized_type_specifier)
+  (type_identifier)
+] @type
+
+[
+  "#define"
+  "#elif"
+  "#else"
+  "#endif"
+  "#if"
+  "#ifdef"
+  "#ifndef"
+  "#include"
+  (preproc_directive)
+] @preproc
+
+[
+  "break"
+  "case"
+  "continue"
+  "default"
+  "do"
+  "else"
+  "enum"
+  "for"
+  "goto"
+  "if"
+  "return"
+  "struct"
+  "switch"
+  "while"
+] @keyword
@@ -0,0 +1,255 @@
+#include "lex.h"
+#include "scan.h"
+
+#include <string.h>
+
+/*
+ * Keywords and types by a perfect hash of their first, middle and last
+ * characters and their length. The multipliers were searched for so that no
+ * two words share a slot; lookups still compare the word.
+ */
+#define HASH(s, n) ((2u * (unsigned char)(s)[0] + 6u * (unsigned char)(s)[(n) / 2] + 15u * (unsigned char)(s)[(n) - 1] + (unsigned)(n)) & 127)
+
+static const struct {
+	char word[10];
+	int  event;
+} keywords[128] = {
+	[  2] = { "uint64_t",  syntax_type },
+	[  5] = { "double",    syntax_type },
+	[ 11] = { "goto",      syntax_keyword },
+	[ 21] = { "ssize_t",   syntax_type },
+	[ 22] = { "size_t",    syntax_type },
+	[ 23] = { "for",       syntax_keyword },
+	[ 26] = { "return",    syntax_keyword },
+	[ 43] = { "ptrdiff_t", syntax_type },
+	[ 47] = { "continue",  syntax_keyword },
+	[ 50] = { "if",        syntax_keyword },
+	[ 53] = { "int",       syntax_type },
+	[ 54] = { "bool",      syntax_type },
+	[ 55] = { "float",     syntax_type },
+	[ 56] = { "unsigned",  syntax_type },
+	[ 60] = { "switch",    syntax_keyword },
+	[ 62] = { "char",      syntax_type },
+	[ 66] = { "void",      syntax_type },
+	[ 75] = { "int16_t",   syntax_type },
+	[ 81] = { "short",     syntax_type },
+	[ 84] = { "while",     syntax_keyword },
+	[ 87] = { "int32_t",   syntax_type },
+	[ 92] = { "signed",    syntax_type },
+	[ 94] = { "intptr_t",  syntax_type },
+	[ 95] = { "uintptr_t", syntax_type },
+	[ 97] = { "default",   syntax_keyword },
+	[100] = { "uint16_t",  syntax_type },
+	[101] = { "do",        syntax_keyword },
+	[103] = { "case",      syntax_keyword },
+	[105] = { "int64_t",   syntax_type },
+	[107] = { "else",      syntax_keyword },
+	[108] = { "break",     syntax_keyword },
+	[111] = { "enum",      syntax_keyword },
+	[112] = { "uint32_t",  syntax_type },
+	[116] = { "int8_t",    syntax_type },
+	[117] = { "uint8_t",   syntax_type },
+	[118] = { "struct",    syntax_keyword },
+	[121] = { "long",      syntax_type },
+};
+
+static bool  block_comment(lexer*, isize, highlight_t*);
+static void  string(lexer*, char);
+static isize word(lexer*);
+static int   keyword(const char*, isize);
+static bool  is_word(char);
+static bool  is_digit(char);
+
+lexer
+lex_begin(const char *p, isize n, bool comment) {
+	return (lexer) { p, n, 0, comment, true, false };
+}
+
+bool
+lex_next(lexer *lx, highlight_t *out) {
+	const char *p = lx->p;
+	isize       n = lx->n;
+
+	if(lx->comment) {
+		lx->comment = false;
+		return block_comment(lx, 0, out);
+	}
+
+	while(lx->i < n) {
+		isize begin = lx->i;
+		char  c     = p[lx->i++];
+		bool  first = lx->blank;
+
+		if(c == '\n') {
+			lx->blank   = true;
+			lx->include = false;
+			continue;
+		}
+
+		if(c == ' ' || c == '\t') {
+			continue;
+		}
+
+		lx->blank = false;
+
+		if(c == '/' && lx->i < n && p[lx->i] == '/') {
+			lx->i += scan_newline(p + lx->i, n - lx->i);
+			*out = (highlight_t) { syntax_comment, begin, lx->i };
+			return true;
+		}
+
+		if(c == '/' && lx->i < n && p[lx->i] == '*') {
+			lx->i++;
+			return block_comment(lx, begin, out);
+		}
+
+		if(c == '"' || c == '\'' || (c == '<' && lx->include)) {
+			string(lx, c == '<' ? '>' : c);
+			*out = (highlight_t) { syntax_string, begin, lx->i };
+			return true;
+		}
+
+		if(c == '#' && first) {
+			while(lx->i < n && (p[lx->i] == ' ' || p[lx->i] == '\t')) {
+				lx->i++;
+			}
+
+			isize length = word(lx);
+			lx->include = length == lengthof("include") && !memcmp(p + lx->i - length, "include", lengthof("include"));
+			*out = (highlight_t) { syntax_preproc, begin, lx->i };
+			return true;
+		}
+
+		if(is_digit(c) || (c == '.' && lx->i < n && is_digit(p[lx->i]))) {
+			while(lx->i < n && (is_word(p[lx->i]) || p[lx->i] == '.')) {
+				lx->i++;
+			}
+
+			*out = (highlight_t) { syntax_number, begin, lx->i };
+			return true;
+		}
+
+		if(is_word(c)) {
+			lx->i--;
+			int event = keyword(p + begin, word(lx));
+
+			if(event >= 0) {
+				*out = (highlight_t) { event, begin, lx->i };
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Returns whether the end of the text is inside a block comment, judging by
+ * the last comment delimiter in it. Like the ccomment sync of vim, this is
+ * fooled by delimiters in strings and by comments longer than the text.
+ */
+bool
+lex_sync(const char *p, isize n) {
+	for(isize i = scan_comment_back(p, n); i >= 0; i = scan_comment_back(p, i)) {
+		if(i > 0 && p[i - 1] == '*') {
+			return false;
+		}
+
+		if(i + 1 < n && p[i + 1] == '*') {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Returns the comment from begin to its end, or to the end of the text. */
+static bool
+block_comment(lexer *lx, isize begin, highlight_t *out) {
+	const char *p = lx->p;
+	isize       n = lx->n;
+
+	for(;;) {
+		lx->i += scan_comment_end(p + lx->i, n - lx->i);
+
+		if(lx->i >= n) {
+			break;
+		}
+
+		if(++lx->i < n && p[lx->i] == '/') {
+			lx->i++;
+			break;
+		}
+	}
+
+	*out = (highlight_t) { syntax_comment, begin, lx->i };
+	return true;
+}
+
+/* Moves past the closing quote, or to the end of the line of an unterminated string. */
+static void
+string(lexer *lx, char quote) {
+	const char *p = lx->p;
+	isize       n = lx->n;
+
+	for(;;) {
+		isize end     = scan_string_end(p + lx->i, n - lx->i, quote);
+		isize newline = scan_newline(p + lx->i, end);
+
+		if(newline < end) {
+			lx->i += newline;
+			return;
+		}
+
+		lx->i += end;
+
+		if(lx->i >= n) {
+			return;
+		}
+
+		if(p[lx->i] != '\\') {
+			lx->i++;
+			return;
+		}
+
+		// An escaped newline continues the string on the next line
+		lx->i = lx->i + 2 < n ? lx->i + 2 : n;
+	}
+}
+
+/* Moves past the word at the position. Returns its length. */
+static isize
+word(lexer *lx) {
+	isize begin = lx->i;
+
+	while(lx->i < lx->n && is_word(lx->p[lx->i])) {
+		lx->i++;
+	}
+
+	return lx->i - begin;
+}
+
+static int
+keyword(const char *s, isize n) {
+	if(n == 0 || n >= sizeof(keywords[0].word)) {
+		return -1;
+	}
+
+	unsigned h = HASH(s, n);
+
+	if(memcmp(keywords[h].word, s, (size_t)n) || keywords[h].word[n]) {
+		return -1;
+	}
+
+	return keywords[h].event;
+}
+
+static bool
+is_word(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_';
+}
+
+static bool
+is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
@@ -0,0 +1,28 @@
+#ifndef BED_LEX_H
+#define BED_LEX_H
+
+#include "syntax.h"
+#include "util.h"
+
+#include <stdbool.h>
+
+/*
+ * A lexical highlighter for C, used for the files too big to parse. It finds
+ * comments, strings, numbers, preprocessor directives and the keywords and
+ * types of highlights.scm in text that begins at the start of a line, and
+ * returns them in order as highlights relative to the text.
+ */
+typedef struct {
+	const char *p;
+	isize       n;
+	isize       i;
+	bool        comment; // The text begins inside a block comment
+	bool        blank;   // Only blanks since the start of the line
+	bool        include; // On an #include line
+} lexer;
+
+lexer lex_begin(const char*, isize, bool);
+bool  lex_next(lexer*, highlight_t*);
+bool  lex_sync(const char*, isize);
+
+#endif // BED_LEX_H
@@ -0,0 +1,128 @@
+#include "load.h"
+#include "scan.h"
+#include "thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct load {
+	char   *file_path;
+	thread  worker;
+	buffer *buf;  // Written by the worker before it sets done
+	isize   read; // Bytes of the file read so far, updated atomically
+	isize   size; // Bytes of the file when loading began, or -1
+	bool    done; // Updated atomically
+};
+
+static void  run(void*);
+static isize file_size(const char*);
+
+/*
+ * Reads up to size bytes from the start of the file, cut after the last
+ * newline unless that is the whole file. Sets complete to whether it is.
+ */
+buffer*
+load_preview(const char *file_path, isize size, b32 *complete) {
+	FILE   *file = fopen(file_path, "rb");
+	char   *data = malloc((size_t)size + 1);
+	buffer *buf;
+
+	if(!file || !data) {
+		goto FAIL;
+	}
+
+	// One more byte than fits tells whether anything is left
+	s8 runes = { (isize)fread(data, 1, (size_t)size + 1, file), data };
+
+	if(ferror(file)) {
+		goto FAIL;
+	}
+
+	*complete = runes.length <= size;
+
+	if(!*complete) {
+		isize last = scan_newline_back(data, size);
+		runes.length = last >= 0 ? last + 1 : size;
+	}
+
+	if(!(buf = buffer_new(0))) {
+		goto FAIL;
+	}
+
+	buffer_insert_runes(buf, 0, runes);
+	fclose(file);
+	free(data);
+	return buf;
+
+FAIL:
+	if(file) fclose(file);
+	free(data);
+	return 0;
+}
+
+load_t*
+load_begin(const char *file_path) {
+	load_t *load = calloc(1, sizeof(load_t));
+
+	if(!load || !(load->file_path = strdup(file_path))) {
+		goto FAIL;
+	}
+
+	load->size = file_size(file_path);
+
+	if(!thread_start(&load->worker, run, load)) {
+		goto FAIL;
+	}
+
+	return load;
+
+FAIL:
+	if(load) free(load->file_path);
+	free(load);
+	return 0;
+}
+
+bool
+load_done(load_t *load) {
+	return __atomic_load_n(&load->done, __ATOMIC_ACQUIRE);
+}
+
+isize
+load_progress(load_t *load) {
+	return __atomic_load_n(&load->read, __ATOMIC_RELAXED);
+}
+
+isize
+load_size(load_t *load) {
+	return load->size;
+}
+
+buffer*
+load_end(load_t *load) {
+	thread_join(load->worker);
+	buffer *buf = load->buf;
+	free(load->file_path);
+	free(load);
+	return buf;
+}
+
+static void
+run(void *arg) {
+	load_t *load = arg;
+	load->buf = buffer_open(0, load->file_path, &load->read);
+	__atomic_store_n(&load->done, true, __ATOMIC_RELEASE);
+}
+
+/* Returns the size of the file in bytes, or -1 if it cannot be told. */
+static isize
+file_size(const char *file_path) {
+#ifdef _WIN32
+	struct _stat64 st;
+	return _stat64(file_path, &st) ? -1 : (isize)st.st_size;
+#else
+	struct stat st;
+	return stat(file_path, &st) ? -1 : (isize)st.st_size;
+#endif
+}
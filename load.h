@@ -0,0 +1,27 @@
+#ifndef BED_LOAD_H
+#define BED_LOAD_H
+
+#include "buffer.h"
+#include "util.h"
+
+#include <stdbool.h>
+
+/*
+ * Opens a file in two steps so that the first frame does not wait for a big
+ * file. load_preview reads the whole lines at the start of the file, and
+ * load_begin opens all of it with buffer_open on a worker thread, and
+ * load_progress tells how many bytes of the file the worker has read so far,
+ * out of the load_size bytes the file had when loading began, or -1 if that
+ * is not known. load_end waits for the worker and returns its buffer, or 0 if the file could
+ * not be opened.
+ */
+typedef struct load load_t;
+
+buffer *load_preview(const char*, isize, b32*);
+load_t *load_begin(const char*);
+bool    load_done(load_t*);
+isize   load_progress(load_t*);
+isize   load_size(load_t*);
+buffer *load_end(load_t*);
+
+#endif // BED_LOAD_H
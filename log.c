@@ -2,20 +2,40 @@
 
 #include <stdlib.h>
 
+void
+log_begin(log_t *log) {
+	if(!log->depth++) {
+		log->join = 0;
+	}
+}
+
+void
+log_end(log_t *log) {
+	assert(log->depth);
+
+	if(!--log->depth) {
+		log->join = 0;
+	}
+}
+
 void
 log_push_insert(log_t *log, isize at, isize length) {
 	log_entry_t *top = log_top(log);
 
-	if(top && top->type == entry_insert && top->at + top->length == at) {
+	// Coalescing must not move an entry into or out of a group
+	if(top && top->type == entry_insert && top->at + top->length == at && (log->depth ? log->join : !top->joined)) {
 		top->length += length;
 	} else {
 		top = log->stack + log->top;
 		top->type = entry_insert;
 		top->at = at;
+		top->joined = log->join;
 		top->length = length;
 		log->top = (log->top + 1) % countof(log->stack);
 		log->length += log->length < countof(log->stack);
 	}
+
+	log->join = log->depth > 0;
 }
 
 void
@@ -23,9 +43,11 @@ log_push_erase(log_t *log, isize at, s8 erased) {
 	log_entry_t *top = log->stack + log->top;
 	top->type = entry_erase;
 	top->at = at;
+	top->joined = log->join;
 	top->erased = erased;
 	log->top = (log->top + 1) % countof(log->stack);
 	log->length += log->length < countof(log->stack);
+	log->join = log->depth > 0;
 }
 
 log_entry_t*
@@ -12,19 +12,28 @@ struct log_entry {
 		entry_erase,
 	} type;
 	isize at;
+	b32   joined; // Undone together with the entry below it
 	union {
 		isize length;
 		s8    erased;
 	};
 };
 
-/* A log is a stack of editing operations represented by a ring buffer. */
+/*
+ * A log is a stack of editing operations represented by a ring buffer.
+ * The entries pushed between log_begin and log_end form a group that is
+ * undone as one. A group larger than the ring loses its oldest entries.
+ */
 struct log {
 	log_entry_t stack[1000];
 	int         top;
 	int         length;
+	int         depth; // Nesting of log_begin
+	b32         join;  // Whether the next entry joins the open group
 };
 
+void         log_begin(log_t*);
+void         log_end(log_t*);
 void         log_push_insert(log_t*, isize, isize);
 void         log_push_erase(log_t*, isize, s8);
 log_entry_t* log_top(log_t*);
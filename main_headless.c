@@ -0,0 +1,468 @@
+#include "buffer.h"
+#include "gui.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Runs the editor without a window, to measure and test gui.c on machines
+ * without a display. Frames are drawn into pixels with a built-in bitmap font,
+ * and the events come from a script on stdin, a command a line:
+ *
+ *   type TEXT                  \n is enter, \t tab, \b backspace, \\ a
+ *                              backslash and \xNN any other byte
+ *   left|up|right|down [N] [shift]
+ *   click|drag|wheelup|wheeldown X Y
+ *   line N                     goes to line N, counting from 1
+ *   percent P                  scrolls P percent of the way through the rows
+ *   resize W H
+ *   dump PATH                  writes the frame as a binary PPM
+ *
+ * After every command the frames are drawn until the editor waits for an
+ * event, and a line is printed with the frames drawn, the time spent in
+ * gui_redraw and the pixels invalidated. Lines starting with # are skipped.
+ */
+
+#define MEM_SIZE (1ull << 40)
+
+// Every glyph is FONT_W by FONT_H pixels of the font, in a cell with a pixel
+// more on the right, above and below, all scaled by scale
+#define FONT_W 5
+#define FONT_H 9
+#define CELL_W (FONT_W + 1)
+#define CELL_H (FONT_H + 2)
+
+extern unsigned *pixels;
+
+static arena      memory;
+static dimensions window   = { 1280, 720 };
+static int        scale    = 2;
+static s8         clipboard;
+static isize      invalidated; // Pixels invalidated since the last command
+
+/* Rows of every printable ASCII rune, the leftmost pixel in bit 4. */
+static const unsigned char font[][FONT_H] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+	{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00 }, // !
+	{ 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+	{ 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A, 0x00, 0x00 }, // #
+	{ 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04, 0x00, 0x00 }, // $
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00, 0x00 }, // %
+	{ 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D, 0x00, 0x00 }, // &
+	{ 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00, 0x00 }, // (
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00, 0x00 }, // )
+	{ 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00, 0x00, 0x00 }, // *
+	{ 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00, 0x00, 0x00 }, // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08, 0x00 }, // ,
+	{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00 }, // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00, 0x00 }, // .
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00, 0x00 }, // /
+	{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E, 0x00, 0x00 }, // 0
+	{ 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x00 }, // 1
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F, 0x00, 0x00 }, // 2
+	{ 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E, 0x00, 0x00 }, // 3
+	{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02, 0x00, 0x00 }, // 4
+	{ 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E, 0x00, 0x00 }, // 5
+	{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E, 0x00, 0x00 }, // 6
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00, 0x00 }, // 7
+	{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E, 0x00, 0x00 }, // 8
+	{ 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C, 0x00, 0x00 }, // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x00 }, // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08, 0x00, 0x00 }, // ;
+	{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00, 0x00 }, // <
+	{ 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00 }, // =
+	{ 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00, 0x00 }, // >
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00, 0x00 }, // ?
+	{ 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E, 0x00, 0x00 }, // @
+	{ 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, 0x00 }, // A
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E, 0x00, 0x00 }, // B
+	{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E, 0x00, 0x00 }, // C
+	{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C, 0x00, 0x00 }, // D
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F, 0x00, 0x00 }, // E
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10, 0x00, 0x00 }, // F
+	{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F, 0x00, 0x00 }, // G
+	{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, 0x00 }, // H
+	{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x00 }, // I
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C, 0x00, 0x00 }, // J
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00, 0x00 }, // K
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x00, 0x00 }, // L
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00, 0x00 }, // M
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00, 0x00 }, // N
+	{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, 0x00 }, // O
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10, 0x00, 0x00 }, // P
+	{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D, 0x00, 0x00 }, // Q
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11, 0x00, 0x00 }, // R
+	{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E, 0x00, 0x00 }, // S
+	{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00 }, // T
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, 0x00 }, // U
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, 0x00 }, // V
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A, 0x00, 0x00 }, // W
+	{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11, 0x00, 0x00 }, // X
+	{ 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00 }, // Y
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F, 0x00, 0x00 }, // Z
+	{ 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E, 0x00, 0x00 }, // [
+	{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00, 0x00 }, // backslash
+	{ 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E, 0x00, 0x00 }, // ]
+	{ 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x00 }, // _
+	{ 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+	{ 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F, 0x00, 0x00 }, // a
+	{ 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E, 0x00, 0x00 }, // b
+	{ 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E, 0x00, 0x00 }, // c
+	{ 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F, 0x00, 0x00 }, // d
+	{ 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E, 0x00, 0x00 }, // e
+	{ 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08, 0x00, 0x00 }, // f
+	{ 0x00, 0x00, 0x0F, 0x11, 0x11, 0x11, 0x0F, 0x01, 0x0E }, // g
+	{ 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x00 }, // h
+	{ 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x00 }, // i
+	{ 0x02, 0x00, 0x06, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, // j
+	{ 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12, 0x00, 0x00 }, // k
+	{ 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x00 }, // l
+	{ 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11, 0x00, 0x00 }, // m
+	{ 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x00 }, // n
+	{ 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E, 0x00, 0x00 }, // o
+	{ 0x00, 0x00, 0x1E, 0x11, 0x11, 0x11, 0x1E, 0x10, 0x10 }, // p
+	{ 0x00, 0x00, 0x0F, 0x11, 0x11, 0x11, 0x0F, 0x01, 0x01 }, // q
+	{ 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10, 0x00, 0x00 }, // r
+	{ 0x00, 0x00, 0x0F, 0x10, 0x0E, 0x01, 0x1E, 0x00, 0x00 }, // s
+	{ 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06, 0x00, 0x00 }, // t
+	{ 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D, 0x00, 0x00 }, // u
+	{ 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, 0x00 }, // v
+	{ 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A, 0x00, 0x00 }, // w
+	{ 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x00, 0x00 }, // x
+	{ 0x00, 0x00, 0x11, 0x11, 0x11, 0x11, 0x0F, 0x01, 0x0E }, // y
+	{ 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F, 0x00, 0x00 }, // z
+	{ 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02, 0x00, 0x00 }, // {
+	{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00 }, // |
+	{ 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08, 0x00, 0x00 }, // }
+	{ 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00, 0x00 }, // ~
+};
+
+// Drawn for the bytes past ASCII, so they stand out
+static const unsigned char box[FONT_H] = { 0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F, 0x00, 0x00 };
+
+static isize
+nanoseconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (isize)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Draws frames until the editor waits for an event, and returns the ns spent drawing. */
+static isize
+settle(int *frames) {
+	isize spent = 0;
+
+	for(;;) {
+		int timeout = gui_next_frame();
+
+		if(timeout < 0) {
+			return spent;
+		}
+
+		if(timeout > 0) {
+			struct timespec wait = { timeout / 1000, (long)(timeout % 1000) * 1000000 };
+			nanosleep(&wait, 0);
+			continue;
+		}
+
+		isize begin = nanoseconds();
+		gui_redraw(memory);
+		spent += nanoseconds() - begin;
+		*frames += 1;
+	}
+}
+
+static b32
+resize(int w, int h) {
+	unsigned *resized = realloc(pixels, (size_t)w * (size_t)h * sizeof(*pixels));
+
+	if(!resized) {
+		return 0;
+	}
+
+	pixels   = resized;
+	window.w = w;
+	window.h = h;
+	gui_reflow();
+	return 1;
+}
+
+static b32
+dump(const char *path) {
+	FILE          *file = fopen(path, "wb");
+	unsigned char *row  = malloc((size_t)window.w * 3);
+
+	if(!file || !row) {
+		goto FAIL;
+	}
+
+	fprintf(file, "P6\n%d %d\n255\n", window.w, window.h);
+
+	for(int y = 0; y < window.h; ++y) {
+		for(int x = 0; x < window.w; ++x) {
+			unsigned pixel = pixels[y * window.w + x];
+			row[3 * x + 0] = (unsigned char)(pixel >> 16);
+			row[3 * x + 1] = (unsigned char)(pixel >> 8);
+			row[3 * x + 2] = (unsigned char)pixel;
+		}
+
+		if(fwrite(row, 3, (size_t)window.w, file) != (size_t)window.w) {
+			goto FAIL;
+		}
+	}
+
+	free(row);
+	return !fclose(file);
+
+FAIL:
+	free(row);
+	if(file) fclose(file);
+	return 0;
+}
+
+/* Types the runes of text, with the escapes described at the top. */
+static void
+type(char *text) {
+	for(char *c = text; *c; ++c) {
+		int rune = (unsigned char)*c;
+
+		if(*c == '\\' && c[1]) {
+			switch(*++c) {
+				case 'n': rune = '\r'; break;
+				case 't': rune = '\t'; break;
+				case 'b': rune = '\b'; break;
+				case 'x': {
+					char  hex[3] = { c[1], c[1] ? c[2] : 0, 0 };
+					char *end;
+					rune = (int)strtol(hex, &end, 16);
+					c   += end - hex;
+					break;
+				}
+				default:  rune = (unsigned char)*c;
+			}
+		}
+
+		gui_keyboard(memory, kbd_char + rune, 0);
+	}
+}
+
+/* Runs a command of the script, and returns 0 if it is not one. */
+static b32
+command(char *line) {
+	char word[16];
+	int  a     = 0;
+	int  b     = 0;
+	int  count = 0;
+
+	if(sscanf(line, "%15s%n", word, &count) != 1) {
+		return 1;
+	}
+
+	char *rest = line + count;
+	rest += *rest == ' ';
+
+	static const char *keys[]   = { "left", "up", "right", "down" };
+	static const char *mouses[] = { "click", "wheelup", "wheeldown", "drag" };
+
+	if(word[0] == '#') {
+		return 1;
+	} else if(!strcmp(word, "type")) {
+		type(rest);
+		return 1;
+	} else if(!strcmp(word, "resize")) {
+		return sscanf(rest, "%d %d", &a, &b) == 2 && a > 0 && b > 0 && resize(a, b);
+	} else if(!strcmp(word, "dump")) {
+		return dump(rest);
+	} else if(!strcmp(word, "line") && sscanf(rest, "%d", &a) == 1) {
+		gui_jump_line(a);
+		return 1;
+	} else if(!strcmp(word, "percent") && sscanf(rest, "%d", &a) == 1) {
+		gui_jump_percent(a);
+		return 1;
+	}
+
+	for(int k = 0; k < 4; ++k) {
+		if(!strcmp(word, keys[k])) {
+			int n = sscanf(rest, "%d", &a) == 1 ? a : 1;
+
+			for(int i = 0; i < n; ++i) {
+				gui_keyboard(memory, kbd_left + k, strstr(rest, "shift") != 0);
+			}
+
+			return 1;
+		}
+
+		if(!strcmp(word, mouses[k])) {
+			if(sscanf(rest, "%d %d", &a, &b) != 2) {
+				return 0;
+			}
+
+			gui_mouse(mouse_left + k, a, b);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv) {
+	const char *output = 0;
+
+	for(int option; (option = getopt(argc, argv, "w:h:s:o:")) != -1;) {
+		switch(option) {
+			case 'w': window.w = atoi(optarg); break;
+			case 'h': window.h = atoi(optarg); break;
+			case 's': scale    = atoi(optarg); break;
+			case 'o': output   = optarg;       break;
+			default:  goto USAGE;
+		}
+	}
+
+	if(optind + 1 != argc || window.w <= 0 || window.h <= 0 || scale <= 0) {
+		goto USAGE;
+	}
+
+	memory.begin = mmap(0, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	memory.end   = memory.begin + MEM_SIZE;
+
+	if(memory.begin == MAP_FAILED) {
+		return 1;
+	}
+
+	char file_path[PATH_MAX];
+
+	if(!realpath(argv[optind], file_path) || !gui_file_open(&memory, file_path)) {
+		return 2;
+	}
+
+	if(!resize(window.w, window.h)) {
+		return 3;
+	}
+
+	static char line[1 << 16];
+	int         frames = 0;
+	isize       spent  = settle(&frames);
+
+	printf("%-24s %6d frames %10.3f ms %10td pixels\n", "open", frames, (double)spent / 1e6, invalidated);
+
+	int status = 0;
+
+	while(fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\r\n")] = 0;
+		invalidated = 0;
+		frames      = 0;
+
+		if(!command(line)) {
+			fprintf(stderr, "bad command: %s\n", line);
+			status = 4;
+			break;
+		}
+
+		spent = settle(&frames);
+		printf("%-24.24s %6d frames %10.3f ms %10td pixels\n", line, frames, (double)spent / 1e6, invalidated);
+	}
+
+	if(!status && output && !dump(output)) {
+		status = 5;
+	}
+
+	gui_close();
+	return status;
+
+USAGE:
+	fprintf(stderr, "usage: %s [-w width] [-h height] [-s font scale] [-o frame.ppm] file < script\n", argv[0]);
+	return 1;
+}
+
+/* GUI IMPLEMENTATION BEGIN */
+
+void
+gui_clipboard_put(buffer *buffer, isize begin, isize end) {
+	char *data = realloc(clipboard.data, (size_t)(end - begin + 1));
+
+	if(data) {
+		buffer_copy(buffer, begin, end, data);
+		clipboard.data   = data;
+		clipboard.length = end - begin;
+	}
+}
+
+s8
+gui_clipboard_get(void) {
+	return clipboard;
+}
+
+int
+gui_font_width(int rune, bool bold) {
+	return CELL_W * scale;
+}
+
+int
+gui_font_height(void) {
+	return CELL_H * scale;
+}
+
+dimensions
+gui_dimensions(void) {
+	return window;
+}
+
+b32
+gui_text(int x, int y, s8 runes, color fg, color bg, bool bold) {
+	return 0;
+}
+
+/* Scales the rows of the rune up, bold ones smeared a pixel of the font to the right. */
+void
+gui_glyph(int rune, bool bold, unsigned char *mask, int w, int h) {
+	const unsigned char *rows = rune >= ' ' && rune <= '~' ? font[rune - ' '] : box;
+
+	memset(mask, 0, (size_t)w * (size_t)h);
+
+	if(rune < ' ') {
+		return;
+	}
+
+	for(int y = 0; y < h; ++y) {
+		int      row  = y / scale - 1;
+		unsigned bits = row >= 0 && row < FONT_H ? (unsigned)rows[row] << 1 : 0; // Leftmost in bit 5
+		bits |= bold ? bits >> 1 : 0;
+
+		for(int x = 0; x < w && x / scale < CELL_W; ++x) {
+			mask[y * w + x] = bits >> (FONT_W - x / scale) & 1 ? 255 : 0;
+		}
+	}
+}
+
+void
+gui_invalidate(int x, int y, int w, int h) {
+	int right  = x + w < window.w ? x + w : window.w;
+	int bottom = y + h < window.h ? y + h : window.h;
+	x = x > 0 ? x : 0;
+	y = y > 0 ? y : 0;
+
+	if(x < right && y < bottom) {
+		invalidated += (isize)(right - x) * (bottom - y);
+	}
+}
+
+isize
+gui_time(void) {
+	return nanoseconds() / 1000000;
+}
+
+/* There is no window to have the focus, so the cursor does not blink. */
+b32
+gui_is_active(void) {
+	return 0;
+}
+
+/* GUI IMPLEMENTATION END */
@@ -117,14 +117,6 @@ window_proc(HWND window, UINT message, WPARAM wParam, LPARAM lParam) {
 			break;
 		}
 
-		case WM_TIMER:
-			if(wParam == 1) {
-				gui_redraw(memory);
-				InvalidateRect(window, 0, 0);
-				UpdateWindow(window);
-			}
-			break;
-
 		case WM_SIZE: {
 			extern unsigned *pixels;
 			static HBITMAP bitmap;
@@ -167,6 +159,7 @@ window_proc(HWND window, UINT message, WPARAM wParam, LPARAM lParam) {
 			break;
 
 		case WM_DESTROY:
+			gui_close();
 			PostQuitMessage(0);
 			break;
 
@@ -232,23 +225,37 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdline, int nCmdS
 	lf.lfHeight = 20;
 	lf.lfWidth = 9;
 	lf.lfWeight = 550;
+	lf.lfQuality = ANTIALIASED_QUALITY; // Grey coverage for the glyph atlas
 	strcpy(lf.lfFaceName, "Cascadia Mono");
 	font = CreateFontIndirect(&lf);
 	lf.lfWeight = FW_BOLD;
 	bold_font = CreateFontIndirect(&lf);
 
 	ShowWindow(window, SW_MAXIMIZE);
-	SetTimer(window, 1, 1000 / 60, 0);
 
-	/* Main event loop */
-	MSG msg;
+	/* Main event loop, which sleeps until there is a message or a frame is due */
+	for(;;) {
+		int timeout = gui_next_frame();
 
-	while(GetMessage(&msg, 0, 0, 0)) {
-		TranslateMessage(&msg);
-		DispatchMessage(&msg);
-	}
+		if(!timeout) {
+			// Only what gui_redraw invalidated is painted
+			gui_redraw(memory);
+			UpdateWindow(window);
+			timeout = gui_next_frame();
+		}
+
+		MsgWaitForMultipleObjects(0, 0, FALSE, timeout < 0 ? INFINITE : (DWORD)timeout, QS_ALLINPUT);
+		MSG msg;
 
-	return (int)msg.wParam;
+		while(PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+			if(msg.message == WM_QUIT) {
+				return (int)msg.wParam;
+			}
+
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+	}
 }
 
 /* GUI IMPLEMENTATION BEGIN */
@@ -258,12 +265,7 @@ gui_clipboard_put(buffer *buffer, isize begin, isize end) {
 	OpenClipboard(window);
 	EmptyClipboard();
 	HGLOBAL mem = GlobalAlloc(GHND, (SIZE_T)(end - begin + 1));
-	char *ptr = GlobalLock(mem);
-
-	for(isize i = begin; i < end; ++i) {
-		*ptr++ = (char)buffer_get(buffer, i);
-	}
-
+	buffer_copy(buffer, begin, end, GlobalLock(mem));
 	GlobalUnlock(mem);
 	SetClipboardData(CF_TEXT, mem);
 	CloseClipboard();
@@ -283,8 +285,9 @@ gui_clipboard_get(void) {
 }
 
 int
-gui_font_width(int rune) {
+gui_font_width(int rune, bool bold) {
 	int width;
+	SelectObject(backbuffer, bold ? bold_font : font);
 	GetCharWidth32(backbuffer, (unsigned)rune, (unsigned)rune, &width);
 	return width;
 }
@@ -303,30 +306,76 @@ gui_dimensions(void) {
 	return (dimensions){ .w = rect.right, .h = rect.bottom };
 }
 
-void
-gui_text(int x, int y, s8 str) {
-	TextOut(backbuffer, x, y, (char*)str.data, (int)str.length);
+/*
+ * Runs of text could be drawn with one ExtTextOut each, but GDI is slower
+ * than the glyph atlas and would look different from other platforms. It
+ * would also have to cope with being called from the render threads.
+ */
+b32
+gui_text(int x, int y, s8 runes, color fg, color bg, bool bold) {
+	return 0;
 }
 
+/*
+ * Draws the rune white on black and keeps the mean of the channels as its
+ * coverage. Every thread draws on a bitmap of its own, so the render workers
+ * can call this at the same time.
+ */
 void
-gui_set_text_color(color rgb) {
-	DWORD r = rgb >> 16 & 0xFF;
-	DWORD g = rgb >>  8 & 0xFF;
-	DWORD b = rgb >>  0 & 0xFF;
-	SetTextColor(backbuffer, RGB(r, g, b));
+gui_glyph(int rune, bool bold, unsigned char *mask, int w, int h) {
+	static _Thread_local HDC       dc;
+	static _Thread_local HBITMAP   bitmap;
+	static _Thread_local unsigned *rgb;
+	static _Thread_local int       bitmap_w;
+	static _Thread_local int       bitmap_h;
+
+	if(w > bitmap_w || h > bitmap_h) {
+		if(bitmap) {
+			DeleteObject(bitmap);
+			DeleteDC(dc);
+		}
+
+		bitmap_w = w > bitmap_w ? w : bitmap_w;
+		bitmap_h = h > bitmap_h ? h : bitmap_h;
+
+		BITMAPINFO bitmap_info = {0};
+		bitmap_info.bmiHeader.biSize        = sizeof(bitmap_info.bmiHeader);
+		bitmap_info.bmiHeader.biPlanes      = 1;
+		bitmap_info.bmiHeader.biBitCount    = 32;
+		bitmap_info.bmiHeader.biCompression = BI_RGB;
+		bitmap_info.bmiHeader.biWidth       =  bitmap_w;
+		bitmap_info.bmiHeader.biHeight      = -bitmap_h;
+
+		dc = CreateCompatibleDC(0);
+		bitmap = CreateDIBSection(0, &bitmap_info, DIB_RGB_COLORS, (void**)&rgb, 0, 0);
+		SelectObject(dc, bitmap);
+		SetTextColor(dc, RGB(255, 255, 255));
+		SetBkColor(dc, RGB(0, 0, 0));
+	}
+
+	char ch   = (char)rune;
+	RECT rect = { 0, 0, w, h };
+	SelectObject(dc, bold ? bold_font : font);
+	ExtTextOut(dc, 0, 0, ETO_OPAQUE, &rect, &ch, 1, 0);
+	GdiFlush();
+
+	for(int y = 0; y < h; ++y) {
+		for(int x = 0; x < w; ++x) {
+			unsigned pixel = rgb[y * bitmap_w + x];
+			mask[y * w + x] = (unsigned char)(((pixel >> 16 & 0xFF) + (pixel >> 8 & 0xFF) + (pixel & 0xFF)) / 3);
+		}
+	}
 }
 
 void
-gui_set_text_bold(bool bold) {
-	SelectObject(backbuffer, bold ? bold_font : font);
+gui_invalidate(int x, int y, int w, int h) {
+	RECT rect = { x, y, x + w, y + h };
+	InvalidateRect(window, &rect, FALSE);
 }
 
-void
-gui_set_bg_color(color rgb) {
-	DWORD r = rgb >> 16 & 0xFF;
-	DWORD g = rgb >>  8 & 0xFF;
-	DWORD b = rgb >>  0 & 0xFF;
-	SetBkColor(backbuffer, RGB(r, g, b));
+isize
+gui_time(void) {
+	return (isize)GetTickCount64();
 }
 
 b32 gui_is_active(void) {
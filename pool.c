@@ -0,0 +1,124 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Every block starts with its size, which keeps the payload 16 byte aligned. */
+#define HEADER    16
+#define MIN_CLASS 16
+
+static int size_class(isize);
+
+void
+pool_init(pool *pool) {
+	memset(pool, 0, sizeof(*pool));
+	mutex_init(&pool->lock);
+}
+
+void*
+pool_alloc(pool *pool, isize n) {
+	isize size = HEADER + n;
+	int   c    = size_class(size);
+	char *block;
+
+	mutex_lock(&pool->lock);
+
+	if(c < 0) {
+		block = malloc((size_t)size);
+		assert(block);
+		pool->stats.reserved += size;
+	} else if(pool->free[c]) {
+		block = pool->free[c];
+		memcpy(&pool->free[c], block, sizeof(void*));
+		size = MIN_CLASS << c;
+	} else {
+		size = MIN_CLASS << c;
+
+		// The rest of a full arena is left unused
+		if(!pool->arena.begin || !(block = arena_alloc(&pool->arena, size, HEADER, 1, ALLOC_NOZERO | ALLOC_RETNULL))) {
+			char *begin = malloc(POOL_ARENA_SIZE);
+			assert(begin);
+			pool->arena = (arena) { begin, begin + POOL_ARENA_SIZE, 0 };
+			pool->stats.reserved += POOL_ARENA_SIZE;
+			block = arena_alloc(&pool->arena, size, HEADER, 1, ALLOC_NOZERO);
+		}
+	}
+
+	pool->stats.bytes += size;
+	pool->stats.blocks++;
+	pool->stats.allocs++;
+	mutex_unlock(&pool->lock);
+	memcpy(block, &size, sizeof(size));
+	return block + HEADER;
+}
+
+void*
+pool_calloc(pool *pool, isize count, isize size) {
+	return memset(pool_alloc(pool, count * size), 0, (size_t)(count * size));
+}
+
+void*
+pool_realloc(pool *pool, void *p, isize n) {
+	if(!p) {
+		return pool_alloc(pool, n);
+	}
+
+	isize size;
+	memcpy(&size, (char*)p - HEADER, sizeof(size));
+
+	// Shrinking and growing within the class keep the block
+	if(HEADER + n <= size && size_class(HEADER + n) == size_class(size)) {
+		return p;
+	}
+
+	void *q = pool_alloc(pool, n);
+	memcpy(q, p, (size_t)(size - HEADER < n ? size - HEADER : n));
+	pool_free(pool, p);
+	return q;
+}
+
+void
+pool_free(pool *pool, void *p) {
+	if(!p) {
+		return;
+	}
+
+	char *block = (char*)p - HEADER;
+	isize size;
+	memcpy(&size, block, sizeof(size));
+	int c = size_class(size);
+
+	mutex_lock(&pool->lock);
+	pool->stats.bytes -= size;
+	pool->stats.blocks--;
+
+	if(c < 0) {
+		pool->stats.reserved -= size;
+		free(block);
+	} else {
+		memcpy(block, &pool->free[c], sizeof(void*));
+		pool->free[c] = block;
+	}
+
+	mutex_unlock(&pool->lock);
+}
+
+pool_stats
+pool_get_stats(pool *pool) {
+	mutex_lock(&pool->lock);
+	pool_stats stats = pool->stats;
+	mutex_unlock(&pool->lock);
+	return stats;
+}
+
+/* Returns the smallest class that fits size, or -1 if none does. */
+static int
+size_class(isize size) {
+	for(int c = 0; c < POOL_CLASSES; ++c) {
+		if(MIN_CLASS << c >= size) {
+			return c;
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,39 @@
+#ifndef BED_POOL_H
+#define BED_POOL_H
+
+#include "thread.h"
+#include "util.h"
+
+/*
+ * A thread-safe allocator for many small blocks that come and go, like the
+ * nodes of parse trees. Blocks are rounded up to a power of two size class
+ * and carved from arenas of POOL_ARENA_SIZE bytes, and freed blocks are kept
+ * on a list per class for the next block of that class. Blocks bigger than the
+ * largest class go to malloc. Every pool counts what it hands out, so each
+ * subsystem with its own pool can tell what its memory costs.
+ */
+#define POOL_CLASSES    9 // 16 to 4096 bytes
+#define POOL_ARENA_SIZE (256 << 10)
+
+typedef struct {
+	isize bytes;    // Bytes in blocks in use, headers included
+	isize blocks;   // Blocks in use
+	isize allocs;   // Blocks ever allocated
+	isize reserved; // Bytes of the arenas and of the blocks from malloc
+} pool_stats;
+
+typedef struct {
+	mutex       lock;
+	arena       arena;                // The arena blocks are carved from
+	void       *free[POOL_CLASSES];   // Freed blocks of every class
+	pool_stats  stats;
+} pool;
+
+void       pool_init(pool*);
+void      *pool_alloc(pool*, isize);
+void      *pool_calloc(pool*, isize, isize);
+void      *pool_realloc(pool*, void*, isize);
+void       pool_free(pool*, void*);
+pool_stats pool_get_stats(pool*);
+
+#endif // BED_POOL_H
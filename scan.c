@@ -0,0 +1,254 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/*
+ * Every kernel looks for the bytes equal to a or b, or with invert set, for
+ * the bytes equal to neither. find returns the index of the first such byte
+ * or n, find_back the index of the last one or -1.
+ */
+typedef struct {
+	isize (*find)(const char*, isize, char, char, int);
+	isize (*find_back)(const char*, isize, char, char, int);
+	isize (*count)(const char*, isize, char);
+} kernels;
+
+static isize
+find_scalar(const char *p, isize n, char a, char b, int invert) {
+	for(isize i = 0; i < n; ++i) {
+		if((p[i] == a || p[i] == b) != invert) {
+			return i;
+		}
+	}
+
+	return n;
+}
+
+static isize
+find_back_scalar(const char *p, isize n, char a, char b, int invert) {
+	for(isize i = n - 1; i >= 0; --i) {
+		if((p[i] == a || p[i] == b) != invert) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static isize
+count_scalar(const char *p, isize n, char a) {
+	isize count = 0;
+
+	for(isize i = 0; i < n; ++i) {
+		count += p[i] == a;
+	}
+
+	return count;
+}
+
+static const kernels scalar = { find_scalar, find_back_scalar, count_scalar };
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static isize
+find_sse2(const char *p, isize n, char a, char b, int invert) {
+	__m128i  va   = _mm_set1_epi8(a);
+	__m128i  vb   = _mm_set1_epi8(b);
+	unsigned flip = invert ? 0xFFFF : 0;
+	isize    i    = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i  v    = _mm_loadu_si128((const __m128i*)(p + i));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))) ^ flip;
+
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + find_scalar(p + i, n - i, a, b, invert);
+}
+
+__attribute__((target("sse2")))
+static isize
+find_back_sse2(const char *p, isize n, char a, char b, int invert) {
+	__m128i  va   = _mm_set1_epi8(a);
+	__m128i  vb   = _mm_set1_epi8(b);
+	unsigned flip = invert ? 0xFFFF : 0;
+	isize    i    = n;
+
+	for(; i >= 16; i -= 16) {
+		__m128i  v    = _mm_loadu_si128((const __m128i*)(p + i - 16));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))) ^ flip;
+
+		if(mask) {
+			return i - 16 + 31 - __builtin_clz(mask);
+		}
+	}
+
+	return find_back_scalar(p, i, a, b, invert);
+}
+
+/* Counts in byte lanes for at most 255 blocks, then sums the lanes. */
+__attribute__((target("sse2")))
+static isize
+count_sse2(const char *p, isize n, char a) {
+	__m128i va    = _mm_set1_epi8(a);
+	__m128i zero  = _mm_setzero_si128();
+	isize   count = 0;
+	isize   i     = 0;
+
+	while(i + 16 <= n) {
+		__m128i acc = zero;
+
+		for(int k = 0; k < 255 && i + 16 <= n; ++k, i += 16) {
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), va));
+		}
+
+		__m128i sum = _mm_sad_epu8(acc, zero);
+		count += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+	}
+
+	return count + count_scalar(p + i, n - i, a);
+}
+
+static const kernels sse2 = { find_sse2, find_back_sse2, count_sse2 };
+
+__attribute__((target("avx2")))
+static isize
+find_avx2(const char *p, isize n, char a, char b, int invert) {
+	__m256i  va   = _mm256_set1_epi8(a);
+	__m256i  vb   = _mm256_set1_epi8(b);
+	unsigned flip = invert ? 0xFFFFFFFF : 0;
+	isize    i    = 0;
+
+	for(; i + 32 <= n; i += 32) {
+		__m256i  v    = _mm256_loadu_si256((const __m256i*)(p + i));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))) ^ flip;
+
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + find_sse2(p + i, n - i, a, b, invert);
+}
+
+__attribute__((target("avx2")))
+static isize
+find_back_avx2(const char *p, isize n, char a, char b, int invert) {
+	__m256i  va   = _mm256_set1_epi8(a);
+	__m256i  vb   = _mm256_set1_epi8(b);
+	unsigned flip = invert ? 0xFFFFFFFF : 0;
+	isize    i    = n;
+
+	for(; i >= 32; i -= 32) {
+		__m256i  v    = _mm256_loadu_si256((const __m256i*)(p + i - 32));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))) ^ flip;
+
+		if(mask) {
+			return i - 32 + 31 - __builtin_clz(mask);
+		}
+	}
+
+	return find_back_sse2(p, i, a, b, invert);
+}
+
+__attribute__((target("avx2")))
+static isize
+count_avx2(const char *p, isize n, char a) {
+	__m256i va    = _mm256_set1_epi8(a);
+	__m256i zero  = _mm256_setzero_si256();
+	isize   count = 0;
+	isize   i     = 0;
+
+	while(i + 32 <= n) {
+		__m256i acc = zero;
+
+		for(int k = 0; k < 255 && i + 32 <= n; ++k, i += 32) {
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), va));
+		}
+
+		__m256i sad = _mm256_sad_epu8(acc, zero);
+		__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+		count += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+	}
+
+	return count + count_sse2(p + i, n - i, a);
+}
+
+static const kernels avx2 = { find_avx2, find_back_avx2, count_avx2 };
+
+#endif // SCAN_X86
+
+/* Threads may race to pick the kernels, but they all pick the same ones. */
+static const kernels*
+cpu(void) {
+	static const kernels *picked;
+	const kernels        *k = __atomic_load_n(&picked, __ATOMIC_RELAXED);
+
+	if(!k) {
+#ifdef SCAN_X86
+		__builtin_cpu_init();
+
+		if(__builtin_cpu_supports("avx2")) {
+			k = &avx2;
+		} else if(__builtin_cpu_supports("sse2")) {
+			k = &sse2;
+		} else
+#endif
+		k = &scalar;
+		__atomic_store_n(&picked, k, __ATOMIC_RELAXED);
+	}
+
+	return k;
+}
+
+isize
+scan_newline(const char *p, isize n) {
+	return cpu()->find(p, n, '\n', '\n', 0);
+}
+
+isize
+scan_newline_back(const char *p, isize n) {
+	return cpu()->find_back(p, n, '\n', '\n', 0);
+}
+
+isize
+scan_count_newlines(const char *p, isize n) {
+	return cpu()->count(p, n, '\n');
+}
+
+isize
+scan_nonblank(const char *p, isize n) {
+	return cpu()->find(p, n, ' ', '\t', 1);
+}
+
+isize
+scan_nonblank_back(const char *p, isize n) {
+	return cpu()->find_back(p, n, ' ', '\t', 1);
+}
+
+isize
+scan_blank_back(const char *p, isize n) {
+	return cpu()->find_back(p, n, ' ', '\t', 0);
+}
+
+isize
+scan_comment_end(const char *p, isize n) {
+	return cpu()->find(p, n, '*', '*', 0);
+}
+
+isize
+scan_comment_back(const char *p, isize n) {
+	return cpu()->find_back(p, n, '/', '/', 0);
+}
+
+isize
+scan_string_end(const char *p, isize n, char quote) {
+	return cpu()->find(p, n, quote, '\\', 0);
+}
@@ -0,0 +1,24 @@
+#ifndef BED_SCAN_H
+#define BED_SCAN_H
+
+#include "util.h"
+
+/*
+ * Byte scanning kernels. Every function picks the widest implementation the
+ * CPU supports the first time it is called. Forward scans return the index of
+ * the first match or the length, backward scans the index of the last match
+ * or -1. A blank is a space or a tab. The comment and string scans find the
+ * bytes that can end a block comment or a string, and the last slash, which
+ * starts or ends every comment.
+ */
+isize scan_newline(const char*, isize);
+isize scan_newline_back(const char*, isize);
+isize scan_count_newlines(const char*, isize);
+isize scan_nonblank(const char*, isize);
+isize scan_nonblank_back(const char*, isize);
+isize scan_blank_back(const char*, isize);
+isize scan_comment_end(const char*, isize);
+isize scan_comment_back(const char*, isize);
+isize scan_string_end(const char*, isize, char);
+
+#endif // BED_SCAN_H
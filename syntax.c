@@ -1,4 +1,7 @@
 #include "syntax.h"
+#include "lex.h"
+#include "pool.h"
+#include "thread.h"
 
 #include <tree_sitter/api.h>
 
@@ -6,37 +9,152 @@
 #include <string.h>
 #include <stdlib.h>
 
-struct syntax_node {
-	TSNode   node;
-	uint32_t i;
-};
-
-struct stack {
-	struct syntax_node *data;
-	isize  length;
-	isize  capacity;
-};
+// Bigger files, or files whose parse takes longer, are highlighted by lex.c
+#ifndef PARSE_LIMIT
+#define PARSE_LIMIT (64 << 20)
+#endif
+#ifndef PARSE_TIMEOUT
+#define PARSE_TIMEOUT 2000000 // Microseconds
+#endif
+
+// How far before the lines to lex to look for the start of a comment
+#define LEX_SYNC (64 << 10)
+
+/*
+ * Parsing runs on a worker thread. Every edit is applied to tree right away,
+ * so the highlights keep following the buffer, and the worker reparses a
+ * snapshot of the buffer starting from a copy of tree. Edits made while the
+ * worker is busy are kept in pending and applied to its result before it
+ * replaces tree. Edits between syntax_begin and syntax_commit are held back
+ * the same way and parsed together.
+ *
+ * Highlights come from the captures of a query and are cached per line. The
+ * query only runs over the visible lines missing from the cache. An edit
+ * drops the cached lines it touches and moves the ones after it, and a new
+ * tree drops the lines ts_tree_get_changed_ranges reports, so scrolling and
+ * typing reuse the highlights of every other line.
+ *
+ * Once a file goes over PARSE_LIMIT or a parse over PARSE_TIMEOUT, tree is
+ * dropped for good and the cache is filled by lex.c instead. A comment opened
+ * or closed by an edit then changes every line after it, so edits drop the
+ * whole cache from their line on.
+ */
+typedef struct {
+	int   event;
+	isize begin; // Columns in the line
+	isize end;
+} span;
+
+typedef struct {
+	span *spans;
+	isize count;
+	bool  valid;
+} line;
 
 struct syntax {
-	TSParser *parser;
-	TSTree   *tree;
-	TSSymbol  string_symbol;
-	TSSymbol  comment_symbol;
-	TSSymbol  preproc_if_symbol;
-	TSFieldId condition_field;
-	bool     *keyword_symbols;
-	struct stack stack;
+	TSParser      *parser;  // Only used by the worker once it runs
+	TSTree        *tree;
+	TSQuery       *query;
+	TSQueryCursor *cursor;
+	int           *events;  // Event of every capture of query, or -1
+	isize          covered; // End of the last highlight collected
+	bool           lexical; // Whether lex.c highlights instead of the query
+	char          *text;    // Copy of the lines lex.c runs over
+	isize          text_size;
+	struct {
+		line  *data;
+		isize  length;
+		isize  capacity;
+	} lines;                // Cached highlights, indexed by row
+	struct {
+		span  *data;
+		isize  length;
+		isize  capacity;
+		isize *rows;        // Row of every span
+	} collected;
+	struct {
+		isize row;
+		isize begin;        // Buffer position of the row
+		isize end;          // Buffer position of the next row
+		isize span;
+		bool  open;         // Between syntax_highlight_begin and syntax_highlight_end
+	} at;                   // Where syntax_highlight_next is in the cache
+	struct {
+		TSInputEdit *data;
+		isize        length;
+		isize        capacity;
+	} pending;
+	bool      busy;     // A job was queued and its tree was not picked up yet
+	int       batch;    // Nesting of syntax_begin
+	bool      running;  // Whether the worker was started
+	thread    worker;
+	mutex     lock;     // Guards the fields below
+	condvar   wake;
+	struct {
+		TSTree *tree;
+		buffer *snapshot;
+	} job;
+	TSTree   *parsed;
+	bool      timed_out; // The last job ran out of time
+	bool      quit;
+	size_t    cancel;    // Stops the parse running, set without the lock
 };
 
 TSLanguage *tree_sitter_c();
 
+// Everything tree-sitter allocates, which is mostly the nodes of trees. The
+// allocator is set for the whole process, so the parsers and query cursors
+// take from it too.
+static pool trees;
+
+// The spans of the cached highlights of every syntax object
+static pool highlights;
+
+static const char *event_names[syntax_end] = {
+	[syntax_comment] = "comment",
+	[syntax_string]  = "string",
+	[syntax_keyword] = "keyword",
+	[syntax_number]  = "number",
+	[syntax_type]    = "type",
+	[syntax_preproc] = "preproc",
+};
+
+static TSQuery    *load_query(TSLanguage*, const char*);
+static int         capture_event(TSQuery*, uint32_t);
+static void        collect(syntax_t*, buffer*, isize, isize);
+static void        lex(syntax_t*, buffer*, isize, isize);
+static void        store(syntax_t*);
+static void        give_up(syntax_t*);
+static void        add_spans(syntax_t*, buffer*, highlight_t);
+static void        drop_lines(syntax_t*, isize, isize);
+static void        move_lines(syntax_t*, const TSInputEdit*);
+static bool        pull(syntax_t*, buffer*, highlight_t*);
+static bool        satisfies(syntax_t*, buffer*, const TSQueryMatch*);
+static bool        equals(buffer*, TSNode, s8);
 static const char *read(void*, uint32_t, TSPoint, uint32_t*);
+static TSPoint     point(buffer*, isize);
 static void        edit(syntax_t*, buffer*, TSInputEdit);
+static void        lex_edit(syntax_t*, isize);
+static void        queue(syntax_t*, buffer*);
+static void        parse(void*);
+static void       *tree_malloc(size_t);
+static void       *tree_calloc(size_t, size_t);
+static void       *tree_realloc(void*, size_t);
+static void        tree_free(void*);
 
 syntax_t*
-syntax_new() {
+syntax_new(const char *query_path) {
 	syntax_t   *syn;
 	TSLanguage *language = tree_sitter_c();
+	static bool pooled;
+
+	// Tree-sitter must not allocate anything before this
+	if(!pooled) {
+		pool_init(&trees);
+		pool_init(&highlights);
+		ts_set_allocator(tree_malloc, tree_calloc, tree_realloc, tree_free);
+		pooled = true;
+	}
 
 	if(!(syn = calloc(1, sizeof(*syn)))) {
 		goto FAIL;
@@ -50,21 +168,31 @@ syntax_new() {
 		goto FAIL;
 	}
 
-	syn->string_symbol  = ts_language_symbol_for_name(language, "string_literal", 14, true);
-	syn->comment_symbol = ts_language_symbol_for_name(language, "comment",         7, true);
-	syn->preproc_if_symbol = ts_language_symbol_for_name(language, "preproc_if",  10, true);
-	syn->condition_field   = ts_language_field_id_for_name(language, "condition",  9);
+	ts_parser_set_timeout_micros(syn->parser, PARSE_TIMEOUT);
+	ts_parser_set_cancellation_flag(syn->parser, &syn->cancel);
 
-	static const char *c99_keywords[] = {
-	    "break", "case", "continue", "default", "do",
-	    "else", "enum", "for", "goto", "if", "return",
-	    "struct", "switch", "while",
-	};
-	syn->keyword_symbols = calloc(ts_language_symbol_count(language), sizeof(bool));
+	if(!(syn->cursor = ts_query_cursor_new())) {
+		goto FAIL;
+	}
 
-	for(int i = 0; i < countof(c99_keywords); ++i) {
-		uint16_t symbol = ts_language_symbol_for_name(language, c99_keywords[i], (uint32_t)strlen(c99_keywords[i]), false);
-		syn->keyword_symbols[symbol] = true;
+	// Without the query the buffer is still parsed, just not highlighted
+	if((syn->query = load_query(language, query_path))) {
+		uint32_t captures = ts_query_capture_count(syn->query);
+
+		if(!(syn->events = calloc(captures + 1, sizeof(int)))) {
+			goto FAIL;
+		}
+
+		for(uint32_t i = 0; i < captures; ++i) {
+			syn->events[i] = capture_event(syn->query, i);
+		}
+	}
+
+	mutex_init(&syn->lock);
+	condvar_init(&syn->wake);
+
+	if(!(syn->running = thread_start(&syn->worker, parse, syn))) {
+		goto FAIL;
 	}
 
 	return syn;
@@ -76,112 +204,559 @@ FAIL:
 
 void
 syntax_free(syntax_t *syn) {
+	if(!syn) {
+		return;
+	}
+
+	if(syn->running) {
+		// Quitting does not wait for a long parse to finish
+		__atomic_store_n(&syn->cancel, 1, __ATOMIC_RELAXED);
+		mutex_lock(&syn->lock);
+		syn->quit = true;
+		condvar_signal(&syn->wake);
+		mutex_unlock(&syn->lock);
+		thread_join(syn->worker);
+		mutex_free(&syn->lock);
+		condvar_free(&syn->wake);
+	}
+
 	if(syn->parser) ts_parser_delete(syn->parser);
+	if(syn->query) ts_query_delete(syn->query);
+	if(syn->cursor) ts_query_cursor_delete(syn->cursor);
 	if(syn->tree) ts_tree_delete(syn->tree);
-	free(syn->keyword_symbols);
-	free(syn->stack.data);
+	if(syn->job.tree) ts_tree_delete(syn->job.tree);
+	if(syn->job.snapshot) buffer_free(syn->job.snapshot);
+	if(syn->parsed) ts_tree_delete(syn->parsed);
+	drop_lines(syn, 0, syn->lines.length);
+	free(syn->lines.data);
+	free(syn->collected.data);
+	free(syn->collected.rows);
+	free(syn->text);
+	free(syn->events);
+	free(syn->pending.data);
 	free(syn);
 }
 
+/* Called after the runes in [begin, end) were inserted into buf. */
 void
 syntax_insert(syntax_t *syn, buffer *buf, isize begin, isize end) {
+	assert(!syn->at.open);
+
+	if(syn->lexical) {
+		lex_edit(syn, buffer_line_at(buf, begin));
+		return;
+	}
+
+	TSPoint start = point(buf, begin);
 	edit(syn, buf, (TSInputEdit) {
-		.start_byte   = (uint32_t)begin,
-		.old_end_byte = (uint32_t)begin,
-		.new_end_byte = (uint32_t)end,
+		.start_byte    = (uint32_t)begin,
+		.old_end_byte  = (uint32_t)begin,
+		.new_end_byte  = (uint32_t)end,
+		.start_point   = start,
+		.old_end_point = start,
+		.new_end_point = point(buf, end),
 	});
 }
 
+/*
+ * Called before the runes in [begin, end) are deleted from buf, between
+ * syntax_begin and syntax_commit, so the old end is still in buf.
+ */
 void
 syntax_delete(syntax_t *syn, buffer *buf, isize begin, isize end) {
+	assert(syn->batch && !syn->at.open);
+
+	if(syn->lexical) {
+		lex_edit(syn, buffer_line_at(buf, begin));
+		return;
+	}
+
+	TSPoint start = point(buf, begin);
 	edit(syn, buf, (TSInputEdit) {
-		.start_byte   = (uint32_t)begin,
-		.old_end_byte = (uint32_t)end,
-		.new_end_byte = (uint32_t)begin,
+		.start_byte    = (uint32_t)begin,
+		.old_end_byte  = (uint32_t)end,
+		.new_end_byte  = (uint32_t)begin,
+		.start_point   = start,
+		.old_end_point = point(buf, end),
+		.new_end_point = start,
 	});
 }
 
-bool syntax_verbose;
+void
+syntax_begin(syntax_t *syn) {
+	syn->batch++;
+}
 
 void
-syntax_highlight_begin(syntax_t *syn) {
-	struct syntax_node *syn_node;
-	syn_node = push(&syn->stack);
-	syn_node->node = ts_tree_root_node(syn->tree);
-	syn_node->i = 0;
+syntax_commit(syntax_t *syn, buffer *buf) {
+	assert(syn->batch);
+
+	if(!--syn->batch && !syn->busy && syn->pending.length) {
+		syn->pending.length = 0;
+		queue(syn, buf);
+	}
+}
+
+/* Returns the bytes tree-sitter and the highlight cache have in use, which all syntax objects share. */
+syntax_memory_t
+syntax_memory(void) {
+	return (syntax_memory_t) { pool_get_stats(&trees).bytes, pool_get_stats(&highlights).bytes };
 }
 
+/* Picks up the tree of a finished parse. Returns whether the highlights changed. */
 bool
-syntax_highlight_next(syntax_t *syn, buffer* buf, isize at, highlight_t *out) {
-	struct syntax_node *syn_node;
-
-	while(syn->stack.length) {
-		struct syntax_node *top = syn->stack.data + syn->stack.length - 1;
-		TSSymbol sym  = ts_node_symbol(top->node);
-		bool     emit = true;
-
-		if(sym == syn->comment_symbol) {
-			out->event = syntax_comment;
-		} else if(sym == syn->preproc_if_symbol) {
-			TSNode cond = ts_node_child_by_field_id(top->node, syn->condition_field);
-
-			if(ts_node_end_byte(cond) - ts_node_start_byte(cond) == 1 && buffer_get(buf, ts_node_start_byte(cond)) == '0') {
-				out->event = syntax_comment;
-			} else {
-				emit = false;
-			}
-		} else if(sym == syn->string_symbol) {
-			out->event = syntax_string;
-		} else if(!ts_node_is_error(top->node) && syn->keyword_symbols[sym]) {
-			out->event = syntax_keyword;
+syntax_poll(syntax_t *syn, buffer *buf) {
+	assert(!syn->at.open);
+
+	if(!syn->busy) {
+		return false;
+	}
+
+	mutex_lock(&syn->lock);
+	TSTree *tree      = syn->parsed;
+	bool    timed_out = syn->timed_out;
+	syn->parsed    = 0;
+	syn->timed_out = false;
+	mutex_unlock(&syn->lock);
+
+	if(timed_out) {
+		give_up(syn);
+		return true;
+	}
+
+	if(!tree) {
+		return false;
+	}
+
+	for(isize i = 0; i < syn->pending.length; ++i) {
+		ts_tree_edit(tree, syn->pending.data + i);
+	}
+
+	if(syn->tree) {
+		uint32_t count;
+		TSRange *ranges = ts_tree_get_changed_ranges(syn->tree, tree, &count);
+
+		for(uint32_t i = 0; i < count; ++i) {
+			drop_lines(syn, ranges[i].start_point.row, (isize)ranges[i].end_point.row + 1);
+		}
+
+		tree_free(ranges);
+		ts_tree_delete(syn->tree);
+	} else {
+		drop_lines(syn, 0, syn->lines.length);
+	}
+
+	syn->tree = tree;
+	syn->busy = false;
+
+	if(syn->pending.length && !syn->batch) {
+		syn->pending.length = 0;
+		queue(syn, buf);
+	}
+
+	return true;
+}
+
+/* Returns whether a parse was queued that syntax_poll has not picked up. */
+bool
+syntax_busy(syntax_t *syn) {
+	return syn->busy;
+}
+
+/* Fills the cache for the lines of [begin, end) and moves to begin. */
+void
+syntax_highlight_begin(syntax_t *syn, buffer *buf, isize begin, isize end) {
+	isize first = buffer_line_at(buf, begin);
+	isize last  = buffer_line_at(buf, end);
+
+	while(syn->lines.length <= last) {
+		*push(&syn->lines) = (line) {0};
+	}
+
+	// Nothing is highlighted until the first parse is done
+	for(isize row = first; (syn->lexical || (syn->tree && syn->query)) && row <= last;) {
+		if(syn->lines.data[row].valid) {
+			row++;
+			continue;
+		}
+
+		isize run = row;
+
+		while(run <= last && !syn->lines.data[run].valid) {
+			run++;
+		}
+
+		isize run_end = run < buffer_line_count(buf) ? buffer_line_begin(buf, run) : buffer_length(buf);
+		if(syn->lexical) {
+			lex(syn, buf, buffer_line_begin(buf, row), run_end);
 		} else {
-			emit = false;
+			collect(syn, buf, buffer_line_begin(buf, row), run_end);
 		}
 
-		if(emit) {
-			out->begin = at;
-			out->end   = ts_node_end_byte(top->node);
-			syn->stack.length--;
-			return true;
+		for(; row < run; ++row) {
+			syn->lines.data[row].valid = true;
 		}
+	}
 
-		for(uint32_t children = ts_node_child_count(top->node); top->i < children; top->i++) {
-			TSNode child = ts_node_child(top->node, top->i);
+	syn->at.row   = first;
+	syn->at.begin = buffer_line_begin(buf, first);
+	syn->at.end   = first + 1 < buffer_line_count(buf) ? buffer_line_begin(buf, first + 1) : buffer_length(buf) + 1;
+	syn->at.span  = 0;
+	syn->at.open  = true;
+}
 
-			if(ts_node_start_byte(child) <= at && at < ts_node_end_byte(child)) {
-				syn_node = push(&syn->stack);
-				syn_node->node = child;
-				syn_node->i = 0;
-				top->i++;
-				goto NEXT;
-			} else if(at < ts_node_start_byte(child)) {
-				if(syntax_verbose) {
-					printf("STOPPING AT CHILD: %s: %u - %u\n", ts_node_type(child), ts_node_start_byte(child), ts_node_end_byte(child));
-				}
+/* Returns the highlight covering at, which the caller asks for in increasing order of at. */
+bool
+syntax_highlight_next(syntax_t *syn, buffer *buf, isize at, highlight_t *out) {
+	assert(syn->at.open);
+
+	while(at >= syn->at.end && syn->at.row + 1 < syn->lines.length) {
+		syn->at.row++;
+		syn->at.begin = syn->at.end;
+		syn->at.end   = syn->at.row + 1 < buffer_line_count(buf) ? buffer_line_begin(buf, syn->at.row + 1) : buffer_length(buf) + 1;
+		syn->at.span  = 0;
+	}
+
+	line *l = syn->lines.data + syn->at.row;
+
+	if(!l->valid || at >= syn->at.end) {
+		return false;
+	}
+
+	while(syn->at.span < l->count && syn->at.begin + l->spans[syn->at.span].end <= at) {
+		syn->at.span++;
+	}
+
+	if(syn->at.span == l->count || syn->at.begin + l->spans[syn->at.span].begin > at) {
+		return false;
+	}
+
+	span s = l->spans[syn->at.span++];
+	*out = (highlight_t) { s.event, at, syn->at.begin + s.end };
+	return true;
+}
+
+/*
+ * Ends the walk over the cache that syntax_highlight_begin started. The walk
+ * points into rows that an edit moves or drops, so edits are only made
+ * outside of one.
+ */
+void
+syntax_highlight_end(syntax_t *syn) {
+	assert(syn->at.open);
+	syn->at.open = false;
+}
+
+/*
+ * Runs the query over [begin, end), which are the bounds of lines, and caches
+ * the highlights of those lines. Highlights do not overlap: a capture
+ * starting inside an earlier one is dropped and of the captures starting
+ * together the longest wins.
+ */
+static void
+collect(syntax_t *syn, buffer *buf, isize begin, isize end) {
+	highlight_t next;
+	highlight_t ahead;
+
+	ts_query_cursor_set_byte_range(syn->cursor, (uint32_t)begin, (uint32_t)end);
+	ts_query_cursor_exec(syn->cursor, syn->query, ts_tree_root_node(syn->tree));
+	syn->covered = 0;
+	syn->collected.length = 0;
+
+	for(bool has_ahead = pull(syn, buf, &ahead); has_ahead;) {
+		next = ahead;
+
+		while((has_ahead = pull(syn, buf, &ahead)) && ahead.begin == next.begin) {
+			next = ahead.end > next.end ? ahead : next;
+		}
+
+		if(next.end <= begin || next.begin >= end) {
+			continue;
+		}
+
+		syn->covered = next.end;
+		has_ahead = has_ahead && (ahead.begin >= syn->covered || pull(syn, buf, &ahead));
+		next.begin = next.begin > begin ? next.begin : begin;
+		next.end   = next.end < end ? next.end : end;
+		add_spans(syn, buf, next);
+	}
+
+	store(syn);
+}
+
+/* Lexes [begin, end), which are the bounds of lines, and caches the highlights of those lines. */
+static void
+lex(syntax_t *syn, buffer *buf, isize begin, isize end) {
+	isize from = begin > LEX_SYNC ? begin - LEX_SYNC : 0;
+
+	if(syn->text_size < end - from) {
+		char *text = realloc(syn->text, (size_t)(end - from));
+		assert(text);
+		syn->text      = text;
+		syn->text_size = end - from;
+	}
+
+	buffer_copy(buf, from, end, syn->text);
+	lexer lx = lex_begin(syn->text + begin - from, end - begin, lex_sync(syn->text, begin - from));
+	syn->collected.length = 0;
+
+	for(highlight_t h; lex_next(&lx, &h);) {
+		h.begin += begin;
+		h.end   += begin;
+		add_spans(syn, buf, h);
+	}
+
+	store(syn);
+}
+
+/* Moves the collected spans to their lines. */
+static void
+store(syntax_t *syn) {
+	// The spans are in order, so every line takes a run of them
+	for(isize i = 0, j; i < syn->collected.length; i = j) {
+		isize row = syn->collected.rows[i];
+		line *l   = syn->lines.data + row;
+
+		for(j = i; j < syn->collected.length && syn->collected.rows[j] == row; ++j);
+
+		l->count = j - i;
+		l->spans = pool_alloc(&highlights, l->count * sizeof(span));
+		memcpy(l->spans, syn->collected.data + i, (size_t)l->count * sizeof(span));
+	}
+}
+
+/* Splits h at the line ends into spans. */
+static void
+add_spans(syntax_t *syn, buffer *buf, highlight_t h) {
+	isize row = buffer_line_at(buf, h.begin);
+
+	while(h.begin < h.end) {
+		isize row_begin = buffer_line_begin(buf, row);
+		isize row_end   = row + 1 < buffer_line_count(buf) ? buffer_line_begin(buf, row + 1) : h.end;
+		isize end       = row_end < h.end ? row_end : h.end;
+
+		if(syn->collected.length == syn->collected.capacity) {
+			isize *rows = realloc(syn->collected.rows, (size_t)(syn->collected.capacity ? 2 * syn->collected.capacity : 1000) * sizeof(isize));
+			assert(rows);
+			syn->collected.rows = rows;
+		}
+
+		syn->collected.rows[syn->collected.length] = row;
+		*push(&syn->collected) = (span) { h.event, h.begin - row_begin, end - row_begin };
+		h.begin = end;
+		row++;
+	}
+}
+
+/* Switches to lex.c for good. */
+static void
+give_up(syntax_t *syn) {
+	syn->lexical = true;
+	syn->busy    = false;
+	syn->pending.length = 0;
+
+	if(syn->tree) {
+		ts_tree_delete(syn->tree);
+		syn->tree = 0;
+	}
+
+	drop_lines(syn, 0, syn->lines.length);
+}
+
+/* Drops the cached highlights of the rows in [first, last). */
+static void
+drop_lines(syntax_t *syn, isize first, isize last) {
+	last = last < syn->lines.length ? last : syn->lines.length;
 
-				return false;
+	for(isize row = first; row < last; ++row) {
+		pool_free(&highlights, syn->lines.data[row].spans);
+		syn->lines.data[row] = (line) {0};
+	}
+}
+
+/* Drops the cached rows an edit touches and moves the rows after it to their new row. */
+static void
+move_lines(syntax_t *syn, const TSInputEdit *edit) {
+	isize row     = edit->start_point.row;
+	isize removed = edit->old_end_point.row - edit->start_point.row;
+	isize added   = edit->new_end_point.row - edit->start_point.row;
+
+	if(row >= syn->lines.length) {
+		return;
+	}
+
+	if(row + removed >= syn->lines.length) {
+		drop_lines(syn, row, syn->lines.length);
+		syn->lines.length = row;
+		return;
+	}
+
+	drop_lines(syn, row, row + removed + 1);
+	isize tail = syn->lines.length - (row + removed + 1);
+
+	while(syn->lines.length < row + added + 1 + tail) {
+		*push(&syn->lines) = (line) {0};
+	}
+
+	line *data = syn->lines.data;
+	memmove(data + row + added + 1, data + row + removed + 1, (size_t)tail * sizeof(line));
+
+	for(isize i = row + 1; i < row + added + 1; ++i) {
+		data[i] = (line) {0};
+	}
+
+	syn->lines.length = row + added + 1 + tail;
+}
+
+/* Reads the query file. Returns 0 if it is missing or does not compile. */
+static TSQuery*
+load_query(TSLanguage *language, const char *query_path) {
+	FILE    *file   = fopen(query_path, "rb");
+	s8       source = {0};
+	TSQuery *query  = 0;
+
+	if(!file) {
+		return 0;
+	}
+
+	if(!fseek(file, 0, SEEK_END) && (source.length = ftell(file)) > 0 && !fseek(file, 0, SEEK_SET)) {
+		if((source.data = malloc((size_t)source.length))) {
+			if(fread(source.data, 1, (size_t)source.length, file) == (size_t)source.length) {
+				uint32_t     error_offset;
+				TSQueryError error;
+				query = ts_query_new(language, source.data, (uint32_t)source.length, &error_offset, &error);
+
+				if(!query) {
+					fprintf(stderr, "%s: error %d at byte %u\n", query_path, error, error_offset);
+				}
 			}
+
+			free(source.data);
+		}
+	}
+
+	fclose(file);
+	return query;
+}
+
+/* Maps a capture named after an event, or after a subcategory like event.sub, to that event. */
+static int
+capture_event(TSQuery *query, uint32_t capture) {
+	uint32_t    length;
+	const char *name = ts_query_capture_name_for_id(query, capture, &length);
+
+	for(int event = 0; event < syntax_end; ++event) {
+		size_t n = strlen(event_names[event]);
+
+		if(length >= n && !memcmp(name, event_names[event], n) && (length == n || name[n] == '.')) {
+			return event;
 		}
+	}
+
+	return -1;
+}
+
+/* Returns the next capture that is highlighted and does not start inside the last highlight. */
+static bool
+pull(syntax_t *syn, buffer *buf, highlight_t *out) {
+	TSQueryMatch match;
+	uint32_t     index;
+
+	if(!syn->tree || !syn->query) {
+		return false;
+	}
 
-		syn->stack.length--;
+	while(ts_query_cursor_next_capture(syn->cursor, &match, &index)) {
+		TSQueryCapture capture = match.captures[index];
+		int            event   = syn->events[capture.index];
+		isize          begin   = ts_node_start_byte(capture.node);
+		isize          end     = ts_node_end_byte(capture.node);
 
-		if(syntax_verbose) {
-			printf("%s: %u - %u\n", ts_node_type(top->node), ts_node_start_byte(top->node), ts_node_end_byte(top->node));
+		if(event >= 0 && begin >= syn->covered && begin < end && satisfies(syn, buf, &match)) {
+			*out = (highlight_t) { event, begin, end };
+			return true;
 		}
-NEXT:;
 	}
 
 	return false;
 }
 
-void
-syntax_highlight_end(syntax_t *syn) {
-	syn->stack.length = 0;
+/* Evaluates the #eq? and #not-eq? predicates of a match. Other predicates always hold. */
+static bool
+satisfies(syntax_t *syn, buffer *buf, const TSQueryMatch *match) {
+	uint32_t                    length;
+	const TSQueryPredicateStep *steps = ts_query_predicates_for_pattern(syn->query, match->pattern_index, &length);
+
+	for(uint32_t i = 0, next; i < length; i = next + 1) {
+		for(next = i; next < length && steps[next].type != TSQueryPredicateStepTypeDone; ++next);
+
+		uint32_t    n;
+		const char *name = ts_query_string_value_for_id(syn->query, steps[i].value_id, &n);
+		bool        eq   = n == 3 && !memcmp(name, "eq?", 3);
+
+		if(!eq && !(n == 7 && !memcmp(name, "not-eq?", 7))) {
+			continue;
+		}
+
+		if(next - i != 3 || steps[i + 1].type != TSQueryPredicateStepTypeCapture || steps[i + 2].type != TSQueryPredicateStepTypeString) {
+			continue;
+		}
+
+		s8 value;
+		value.data = (char*)ts_query_string_value_for_id(syn->query, steps[i + 2].value_id, &n);
+		value.length = n;
+		bool equal = false;
+
+		for(uint16_t j = 0; j < match->capture_count; ++j) {
+			if(match->captures[j].index == steps[i + 1].value_id) {
+				equal = equals(buf, match->captures[j].node, value);
+				break;
+			}
+		}
+
+		if(equal != eq) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
+/* Compares the text of node with str chunk by chunk. */
+static bool
+equals(buffer *buf, TSNode node, s8 str) {
+	isize begin = ts_node_start_byte(node);
+	isize end   = ts_node_end_byte(node);
+
+	if(end - begin != str.length || end > buffer_length(buf)) {
+		return false;
+	}
+
+	buffer_iter it = buffer_iter_begin(buf, begin, end);
+
+	for(s8 chunk; buffer_iter_next(&it, &chunk); str.data += chunk.length) {
+		if(memcmp(chunk.data, str.data, (size_t)chunk.length)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Tree-sitter counts bytes in 32 bits, which the buffers it parses fit in as they are under PARSE_LIMIT. */
 static const char*
 read(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read) {
-	return buffer_read(payload, byte_index, bytes_read);
+	isize       n;
+	const char *runes = buffer_read(payload, byte_index, &n);
+	*bytes_read = (uint32_t)n;
+	return runes;
+}
+
+/* Returns the row and byte column of pos, as tree-sitter counts them. */
+static TSPoint
+point(buffer *buf, isize pos) {
+	isize row = buffer_line_at(buf, pos);
+	return (TSPoint) { (uint32_t)row, (uint32_t)(pos - buffer_line_begin(buf, row)) };
 }
 
 static void
@@ -190,16 +765,105 @@ edit(syntax_t *syn, buffer *buf, TSInputEdit edit) {
 		ts_tree_edit(syn->tree, &edit);
 	}
 
-	TSTree *tree = ts_parser_parse(syn->parser, syn->tree, (TSInput) {
-		.read = read,
-		.payload = buf,
-		.encoding = TSInputEncodingUTF8,
-	});
-	assert(tree);
+	move_lines(syn, &edit);
 
-	if(syn->tree) {
-		ts_tree_delete(syn->tree);
+	if(syn->busy || syn->batch) {
+		*push(&syn->pending) = edit;
+	} else {
+		queue(syn, buf);
 	}
+}
 
-	syn->tree = tree;
+/*
+ * Follows an edit on row once lex.c highlights instead of the query. Rows of
+ * a file that big do not fit tree-sitter's 32 bits, so row is a line number.
+ */
+static void
+lex_edit(syntax_t *syn, isize row) {
+	drop_lines(syn, row, syn->lines.length);
+	syn->lines.length = row < syn->lines.length ? row : syn->lines.length;
+}
+
+/* Hands the worker a snapshot of buf and a copy of the tree, which matches it. */
+static void
+queue(syntax_t *syn, buffer *buf) {
+	if(buffer_length(buf) > PARSE_LIMIT) {
+		give_up(syn);
+		return;
+	}
+
+	buffer *snapshot = buffer_snapshot(buf);
+	TSTree *tree     = syn->tree ? ts_tree_copy(syn->tree) : 0;
+	assert(snapshot);
+
+	mutex_lock(&syn->lock);
+	syn->job.tree     = tree;
+	syn->job.snapshot = snapshot;
+	condvar_signal(&syn->wake);
+	mutex_unlock(&syn->lock);
+	syn->busy = true;
+}
+
+static void
+parse(void *arg) {
+	syntax_t *syn = arg;
+	mutex_lock(&syn->lock);
+
+	for(;;) {
+		while(!syn->job.snapshot && !syn->quit) {
+			condvar_wait(&syn->wake, &syn->lock);
+		}
+
+		if(syn->quit) {
+			break;
+		}
+
+		TSTree *old      = syn->job.tree;
+		buffer *snapshot = syn->job.snapshot;
+		syn->job.tree     = 0;
+		syn->job.snapshot = 0;
+		mutex_unlock(&syn->lock);
+
+		TSTree *tree = ts_parser_parse(syn->parser, old, (TSInput) {
+			.read = read,
+			.payload = snapshot,
+			.encoding = TSInputEncodingUTF8,
+		});
+
+		// Only a timeout or syntax_free stops a parse
+		if(!tree) {
+			ts_parser_reset(syn->parser);
+		}
+
+		if(old) {
+			ts_tree_delete(old);
+		}
+
+		buffer_free(snapshot);
+		mutex_lock(&syn->lock);
+		syn->parsed    = tree;
+		syn->timed_out = !tree;
+	}
+
+	mutex_unlock(&syn->lock);
+}
+
+static void*
+tree_malloc(size_t size) {
+	return pool_alloc(&trees, (isize)size);
+}
+
+static void*
+tree_calloc(size_t count, size_t size) {
+	return pool_calloc(&trees, (isize)count, (isize)size);
+}
+
+static void*
+tree_realloc(void *p, size_t size) {
+	return pool_realloc(&trees, p, (isize)size);
+}
+
+static void
+tree_free(void *p) {
+	pool_free(&trees, p);
 }
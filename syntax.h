@@ -14,18 +14,31 @@ struct highlight {
 		syntax_comment,
 		syntax_string,
 		syntax_keyword,
+		syntax_number,
+		syntax_type,
+		syntax_preproc,
 		syntax_end,
 	} event;
 	isize begin;
 	isize end;
 };
 
-syntax_t *syntax_new();
-void      syntax_free(syntax_t*);
-void      syntax_insert(syntax_t*, buffer*, isize, isize);
-void      syntax_delete(syntax_t*, buffer*, isize, isize);
-void      syntax_highlight_begin(syntax_t*);
-bool      syntax_highlight_next(syntax_t*, buffer*, isize, highlight_t*);
-void      syntax_highlight_end(syntax_t*);
+typedef struct {
+	isize trees;      // Bytes tree-sitter has in use, parsers and query cursors included
+	isize highlights; // Bytes of the cached highlights
+} syntax_memory_t;
+
+syntax_t        *syntax_new(const char*);
+void             syntax_free(syntax_t*);
+void             syntax_insert(syntax_t*, buffer*, isize, isize);
+void             syntax_delete(syntax_t*, buffer*, isize, isize);
+void             syntax_begin(syntax_t*);
+void             syntax_commit(syntax_t*, buffer*);
+bool             syntax_poll(syntax_t*, buffer*);
+bool             syntax_busy(syntax_t*);
+syntax_memory_t  syntax_memory(void);
+void             syntax_highlight_begin(syntax_t*, buffer*, isize, isize);
+bool             syntax_highlight_next(syntax_t*, buffer*, isize, highlight_t*);
+void             syntax_highlight_end(syntax_t*);
 
 #endif // BED_SYNTAX_H
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <tree_sitter/api.h>
+
+#include "buffer.h"
+
+/*
+ * Measures how long tree-sitter takes to reparse a file after single rune
+ * edits, once with the edits described by byte offsets only and once with
+ * their rows and columns as well.
+ * Usage: syntax_bench file.c [edits]
+ */
+
+TSLanguage *tree_sitter_c();
+
+/* Tree-sitter counts bytes in 32 bits, so a chunk is cut short where it would not fit. */
+static const char*
+read(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read) {
+	isize       n;
+	const char *runes = buffer_read(payload, byte_index, &n);
+	*bytes_read = (uint32_t)(n < UINT32_MAX ? n : UINT32_MAX);
+	return runes;
+}
+
+static TSPoint
+point(buffer *buf, isize pos) {
+	isize row = buffer_line_at(buf, pos);
+	return (TSPoint) { (uint32_t)row, (uint32_t)(pos - buffer_line_begin(buf, row)) };
+}
+
+/* Applies the same random edits to the file and reparses after each one. Returns the seconds spent parsing. */
+static double
+bench(const char *file_path, b32 points, int edits) {
+	buffer   *buf    = buffer_open(NULL, file_path, NULL);
+	TSParser *parser = ts_parser_new();
+
+	if(!buf || !parser || !ts_parser_set_language(parser, tree_sitter_c())) {
+		fprintf(stderr, "cannot parse %s\n", file_path);
+		exit(1);
+	}
+
+	TSInput input = { buf, read, TSInputEncodingUTF8 };
+	TSTree *tree  = ts_parser_parse(parser, 0, input);
+	clock_t total = 0;
+	srand(1);
+
+	for(int i = 0; i < edits; ++i) {
+		isize       length = buffer_length(buf);
+		isize       at     = rand() % (length + 1);
+		TSInputEdit edit   = { .start_byte = (uint32_t)at, .start_point = point(buf, at) };
+
+		if(rand() % 2 || at == length) {
+			s8 runes = rand() % 2 ? s8("\n") : s8("x");
+			buffer_insert_runes(buf, at, runes);
+			edit.old_end_byte  = (uint32_t)at;
+			edit.new_end_byte  = (uint32_t)(at + runes.length);
+			edit.old_end_point = edit.start_point;
+			edit.new_end_point = point(buf, at + runes.length);
+		} else {
+			edit.old_end_byte  = (uint32_t)(at + 1);
+			edit.new_end_byte  = (uint32_t)at;
+			edit.old_end_point = point(buf, at + 1);
+			edit.new_end_point = edit.start_point;
+			buffer_delete_runes(buf, at, at + 1);
+		}
+
+		if(!points) {
+			edit.start_point = edit.old_end_point = edit.new_end_point = (TSPoint) {0};
+		}
+
+		ts_tree_edit(tree, &edit);
+		clock_t begin = clock();
+		TSTree *next  = ts_parser_parse(parser, tree, input);
+		total += clock() - begin;
+		ts_tree_delete(tree);
+		tree = next;
+	}
+
+	ts_tree_delete(tree);
+	ts_parser_delete(parser);
+	buffer_free(buf);
+	return (double)total / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	int edits = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if(argc < 2 || edits < 1) {
+		fprintf(stderr, "usage: %s file.c [edits]\n", argv[0]);
+		return 1;
+	}
+
+	double bytes  = bench(argv[1], 0, edits);
+	double points = bench(argv[1], 1, edits);
+	printf("%d edits, reparse time per edit\n", edits);
+	printf("  byte offsets only: %8.3f ms\n", 1000 * bytes / edits);
+	printf("  with points:       %8.3f ms\n", 1000 * points / edits);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct {
+	void (*run)(void*);
+	void  *arg;
+} start;
+
+#ifdef _WIN32
+
+/* Returns how many threads can run at once. */
+int
+thread_cpus(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+static DWORD WINAPI
+trampoline(LPVOID param) {
+	start s = *(start*)param;
+	free(param);
+	s.run(s.arg);
+	return 0;
+}
+
+b32
+thread_start(thread *t, void (*run)(void*), void *arg) {
+	start *s = malloc(sizeof(start));
+
+	if(!s) {
+		return 0;
+	}
+
+	*s = (start) { run, arg };
+
+	if(!(*t = CreateThread(0, 0, trampoline, s, 0, 0))) {
+		free(s);
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+thread_join(thread t) {
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+void
+mutex_init(mutex *m) {
+	InitializeSRWLock(m);
+}
+
+void
+mutex_free(mutex *m) {
+}
+
+void
+mutex_lock(mutex *m) {
+	AcquireSRWLockExclusive(m);
+}
+
+void
+mutex_unlock(mutex *m) {
+	ReleaseSRWLockExclusive(m);
+}
+
+void
+condvar_init(condvar *c) {
+	InitializeConditionVariable(c);
+}
+
+void
+condvar_free(condvar *c) {
+}
+
+void
+condvar_wait(condvar *c, mutex *m) {
+	SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+void
+condvar_signal(condvar *c) {
+	WakeConditionVariable(c);
+}
+
+void
+condvar_broadcast(condvar *c) {
+	WakeAllConditionVariable(c);
+}
+
+#else
+
+int
+thread_cpus(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+static void*
+trampoline(void *param) {
+	start s = *(start*)param;
+	free(param);
+	s.run(s.arg);
+	return 0;
+}
+
+b32
+thread_start(thread *t, void (*run)(void*), void *arg) {
+	start *s = malloc(sizeof(start));
+
+	if(!s) {
+		return 0;
+	}
+
+	*s = (start) { run, arg };
+
+	if(pthread_create(t, 0, trampoline, s)) {
+		free(s);
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+thread_join(thread t) {
+	pthread_join(t, 0);
+}
+
+void
+mutex_init(mutex *m) {
+	pthread_mutex_init(m, 0);
+}
+
+void
+mutex_free(mutex *m) {
+	pthread_mutex_destroy(m);
+}
+
+void
+mutex_lock(mutex *m) {
+	pthread_mutex_lock(m);
+}
+
+void
+mutex_unlock(mutex *m) {
+	pthread_mutex_unlock(m);
+}
+
+void
+condvar_init(condvar *c) {
+	pthread_cond_init(c, 0);
+}
+
+void
+condvar_free(condvar *c) {
+	pthread_cond_destroy(c);
+}
+
+void
+condvar_wait(condvar *c, mutex *m) {
+	pthread_cond_wait(c, m);
+}
+
+void
+condvar_signal(condvar *c) {
+	pthread_cond_signal(c);
+}
+
+void
+condvar_broadcast(condvar *c) {
+	pthread_cond_broadcast(c);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef BED_THREAD_H
+#define BED_THREAD_H
+
+#include "util.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE             thread;
+typedef SRWLOCK            mutex;
+typedef CONDITION_VARIABLE condvar;
+#else
+#include <pthread.h>
+typedef pthread_t          thread;
+typedef pthread_mutex_t    mutex;
+typedef pthread_cond_t     condvar;
+#endif
+
+/* A thin layer over the threads of the platform. */
+int  thread_cpus(void);
+b32  thread_start(thread*, void (*)(void*), void*);
+void thread_join(thread);
+void mutex_init(mutex*);
+void mutex_free(mutex*);
+void mutex_lock(mutex*);
+void mutex_unlock(mutex*);
+void condvar_init(condvar*);
+void condvar_free(condvar*);
+void condvar_wait(condvar*, mutex*);
+void condvar_signal(condvar*);
+void condvar_broadcast(condvar*);
+
+#endif // BED_THREAD_H
@@ -35,14 +35,11 @@ slice_grow(void *slice, isize sz) {
 	} header;
 	memcpy(&header, slice, sizeof(header));
 
-	void *data = header.data;
+	// Like calloc, everything past the length is zero
 	header.capacity = header.capacity ? 2 * header.capacity : 1000;
-	header.data = calloc((size_t)header.capacity, (size_t)sz);
-
-	if(data) {
-		memcpy(header.data, data, (size_t)(header.length * sz));
-		free(data);
-	}
+	header.data = realloc(header.data, (size_t)(header.capacity * sz));
+	assert(header.data);
+	memset((char*)header.data + header.length * sz, 0, (size_t)((header.capacity - header.length) * sz));
 
 	memcpy(slice, &header, sizeof(header));
 }